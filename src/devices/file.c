@@ -1,8 +1,16 @@
+/* d_type and fstatat, past the POSIX the build asks for */
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/types.h>
 #include <unistd.h>
 
 #include "file.h"
@@ -19,68 +27,326 @@ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
 WITH REGARD TO THIS SOFTWARE.
 */
 
+#define WRITE_BACK 0x10000
+#define RESULTS 0x100
+
 struct UxnFile {
 	FILE *f;
-	DIR *dir;
 	char current_filename[4096];
-	struct dirent *de;
 	enum { IDLE,
 		FILE_READ,
 		FILE_WRITE,
-		DIR_READ } state;
+		DIR_READ,
+		MAP_READ } state;
+	long offset;     /* where the next stream opened starts, when seek is set */
+	int seek, dirty; /* dirty: written back since the last flush */
+	/* mapped file, kept after closing in case it is read again */
+	Uint8 *map;
+	int fd;
+	size_t size, pos;
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	int mapped, stale;
+	UxnFile *next;
+	/* listed directory, kept until the directory changes */
+	char *list;
+	size_t list_size, list_pos, list_cap;
+	dev_t list_dev;
+	ino_t list_ino;
+	time_t list_mtime;
+	long list_nsec;
+	off_t list_length;
+	unsigned long list_changes;
+	/* asynchronous request, run by the worker */
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int started, quit, notify[2];
+	enum { NONE,
+		QUEUED,
+		DONE } job;
+	Uint8 port, flags, *ram;
+	Uint16 addr, len, res;
+	/* results taken off the worker, not yet reported to the vector */
+	Uint16 results[RESULTS];
+	int first, count;
 };
 
+/* Mapped reads: regular files are read from a private mapping of the whole
+file, which is kept once the file is closed and used again when the same file
+is opened unchanged. Touching the pages of a file truncated since would fault,
+so each read is clipped to the size of the file at the time, through a
+descriptor kept open with the mapping. Opening a mapped file for writing also
+marks its mappings stale, and their next read goes on from a stream instead. */
+
+static pthread_mutex_t maps_lock = PTHREAD_MUTEX_INITIALIZER;
+static UxnFile *maps;
+static unsigned long changes; /* files written or deleted, for listings */
+
+static void
+file_changed(void)
+{
+	pthread_mutex_lock(&maps_lock);
+	changes++;
+	pthread_mutex_unlock(&maps_lock);
+}
+
+static void
+file_unmap(UxnFile *c)
+{
+	UxnFile **p;
+	if(!c->mapped)
+		return;
+	pthread_mutex_lock(&maps_lock);
+	for(p = &maps; *p; p = &(*p)->next)
+		if(*p == c) {
+			*p = c->next;
+			break;
+		}
+	pthread_mutex_unlock(&maps_lock);
+	if(c->map)
+		munmap(c->map, c->size);
+	close(c->fd);
+	c->map = NULL, c->mapped = 0;
+}
+
+static int
+file_map(UxnFile *c)
+{
+	struct stat st;
+	void *map = NULL;
+	int fd = open(c->current_filename, O_RDONLY), stale;
+	if(fd < 0)
+		return 0;
+	if(fstat(fd, &st) || !S_ISREG(st.st_mode) || (size_t)st.st_size != (Uint32)st.st_size) {
+		close(fd);
+		return 0;
+	}
+	pthread_mutex_lock(&maps_lock);
+	stale = c->stale;
+	pthread_mutex_unlock(&maps_lock);
+	if(c->mapped && !stale && c->dev == st.st_dev && c->ino == st.st_ino && c->size == (size_t)st.st_size && c->mtime == st.st_mtime) {
+		close(fd);
+		c->pos = 0, c->state = MAP_READ;
+		return 1;
+	}
+	file_unmap(c);
+	if(st.st_size && (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return 0;
+	}
+#ifdef POSIX_MADV_SEQUENTIAL
+	if(map)
+		posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+#endif
+	c->map = map, c->fd = fd, c->size = st.st_size, c->pos = 0;
+	c->dev = st.st_dev, c->ino = st.st_ino, c->mtime = st.st_mtime;
+	pthread_mutex_lock(&maps_lock);
+	c->stale = 0, c->next = maps, maps = c;
+	pthread_mutex_unlock(&maps_lock);
+	c->mapped = 1, c->state = MAP_READ;
+	return 1;
+}
+
+static Uint16
+file_read_map(UxnFile *c, void *dest, Uint16 len)
+{
+	struct stat st;
+	size_t size;
+	pthread_mutex_lock(&maps_lock);
+	if(!c->stale) {
+		size = fstat(c->fd, &st) ? 0 : (size_t)st.st_size < c->size ? (size_t)st.st_size : c->size;
+		if(c->pos >= size)
+			len = 0;
+		else if(len > size - c->pos)
+			len = size - c->pos;
+		/* an empty file has no mapping to copy from */
+		if(len && c->map)
+			memcpy(dest, c->map + c->pos, len), c->pos += len;
+		else
+			len = 0;
+		pthread_mutex_unlock(&maps_lock);
+		return len;
+	}
+	pthread_mutex_unlock(&maps_lock);
+	file_unmap(c);
+	c->state = IDLE;
+	if((c->f = fopen(c->current_filename, "rb")) == NULL)
+		return 0;
+	c->state = FILE_READ;
+	fseek(c->f, c->pos, SEEK_SET);
+	return fread(dest, 1, len, c->f);
+}
+
+/* open a file for writing, once the mappings it would truncate are stale */
+static FILE *
+file_open_write(const char *filename, const char *mode)
+{
+	struct stat st;
+	UxnFile *c;
+	FILE *f;
+	pthread_mutex_lock(&maps_lock);
+	if(!stat(filename, &st))
+		for(c = maps; c; c = c->next)
+			if(c->dev == st.st_dev && c->ino == st.st_ino)
+				c->stale = 1;
+	f = fopen(filename, mode);
+	pthread_mutex_unlock(&maps_lock);
+	return f;
+}
+
 static void
 reset(UxnFile *c)
 {
 	if(c->f != NULL) {
 		fclose(c->f);
 		c->f = NULL;
+		if(c->dirty)
+			file_changed(), c->dirty = 0;
 	}
-	if(c->dir != NULL) {
-		closedir(c->dir);
-		c->dir = NULL;
-	}
-	c->de = NULL;
 	c->state = IDLE;
 }
 
 static Uint16
-get_entry(char *p, Uint16 len, const char *pathname, const char *basename, int fail_nonzero)
+put_entry(char *p, Uint16 len, struct stat *st, const char *basename)
 {
-	struct stat st;
 	if(len < strlen(basename) + 7)
 		return 0;
-	if(stat(pathname, &st))
-		return fail_nonzero ? sprintf(p, "!!!! %s\n", basename) : 0;
-	else if(S_ISDIR(st.st_mode))
+	else if(S_ISDIR(st->st_mode))
 		return sprintf(p, "---- %s\n", basename);
-	else if(st.st_size < 0x10000)
-		return sprintf(p, "%04x %s\n", (unsigned int)st.st_size, basename);
+	else if(st->st_size < 0x10000)
+		return sprintf(p, "%04x %s\n", (unsigned int)st->st_size, basename);
+	else if(st->st_size <= 0xffffffff && len >= strlen(basename) + 11)
+		return sprintf(p, "%08lx %s\n", (unsigned long)st->st_size, basename);
 	else
 		return sprintf(p, "???? %s\n", basename);
 }
 
 static Uint16
-file_read_dir(UxnFile *c, char *dest, Uint16 len)
+get_entry(char *p, Uint16 len, const char *pathname, const char *basename)
+{
+	struct stat st;
+	if(stat(pathname, &st))
+		return 0;
+	return put_entry(p, len, &st, basename);
+}
+
+/* Listing: a directory is listed once into lines of text, each entry typed
+from its d_type and sized with fstatat on the directory, and read from there in
+whole lines. Opening it again lists it anew only when its mtime or length have
+changed since, or when a file has been written or deleted through any device,
+as rewriting a file leaves its directory as it was. */
+
+static int
+list_stat(UxnFile *c, int fd, const char *name, struct stat *st)
+{
+#ifdef AT_FDCWD
+	(void)c;
+	return fstatat(fd, name, st, 0);
+#else
+	char pathname[4352];
+	(void)fd;
+	if(strlen(c->current_filename) + 1 + strlen(name) >= sizeof(pathname))
+		return -1;
+	sprintf(pathname, "%s/%s", c->current_filename, name);
+	return stat(pathname, st);
+#endif
+}
+
+static int
+list_entry(UxnFile *c, int fd, struct dirent *de)
 {
-	static char pathname[4352];
-	char *p = dest;
-	if(c->de == NULL) c->de = readdir(c->dir);
-	for(; c->de != NULL; c->de = readdir(c->dir)) {
-		Uint16 n;
-		if(c->de->d_name[0] == '.' && c->de->d_name[1] == '\0')
+	struct stat st;
+	size_t len = strlen(de->d_name) + 12;
+	char *p;
+	int isdir = 0;
+	if(c->list_size + len > c->list_cap) {
+		size_t cap = c->list_cap ? c->list_cap * 2 : 0x1000;
+		while(cap < c->list_size + len)
+			cap *= 2;
+		if((p = realloc(c->list, cap)) == NULL)
+			return 0;
+		c->list = p, c->list_cap = cap;
+	}
+	p = c->list + c->list_size;
+#ifdef DT_DIR
+	isdir = de->d_type == DT_DIR;
+#endif
+	if(isdir)
+		c->list_size += sprintf(p, "---- %s\n", de->d_name);
+	else if(list_stat(c, fd, de->d_name, &st))
+		c->list_size += sprintf(p, "!!!! %s\n", de->d_name);
+	else
+		c->list_size += put_entry(p, len, &st, de->d_name);
+	return 1;
+}
+
+/* a second is too coarse to tell a directory written after it was listed */
+static long
+mtime_nsec(struct stat *st)
+{
+#if _POSIX_C_SOURCE >= 200809L
+	return st->st_mtim.tv_nsec;
+#else
+	(void)st;
+	return 0;
+#endif
+}
+
+static int
+file_list(UxnFile *c)
+{
+	struct stat st;
+	struct dirent *de;
+	DIR *dir = opendir(c->current_filename);
+	int fd = -1, changed;
+	if(dir == NULL)
+		return 0;
+#ifdef AT_FDCWD
+	fd = dirfd(dir);
+#endif
+	if(stat(c->current_filename, &st)) {
+		closedir(dir);
+		return 0;
+	}
+	pthread_mutex_lock(&maps_lock);
+	changed = c->list_changes != changes, c->list_changes = changes;
+	pthread_mutex_unlock(&maps_lock);
+	c->list_pos = 0, c->state = DIR_READ;
+	if(c->list && !changed && c->list_dev == st.st_dev && c->list_ino == st.st_ino && c->list_mtime == st.st_mtime && c->list_nsec == mtime_nsec(&st) && c->list_length == st.st_size) {
+		closedir(dir);
+		return 1;
+	}
+	c->list_size = 0;
+	while((de = readdir(dir)) != NULL) {
+		if(de->d_name[0] == '.' && de->d_name[1] == '\0')
 			continue;
-		if(strlen(c->current_filename) + 1 + strlen(c->de->d_name) < sizeof(pathname))
-			sprintf(pathname, "%s/%s", c->current_filename, c->de->d_name);
-		else
-			pathname[0] = '\0';
-		n = get_entry(p, len, pathname, c->de->d_name, 1);
-		if(!n) break;
-		p += n;
-		len -= n;
+		if(!list_entry(c, fd, de))
+			break;
 	}
-	return p - dest;
+	closedir(dir);
+	c->list_dev = st.st_dev, c->list_ino = st.st_ino;
+	c->list_mtime = st.st_mtime, c->list_nsec = mtime_nsec(&st);
+	c->list_length = st.st_size;
+	return 1;
+}
+
+static Uint16
+file_read_dir(UxnFile *c, char *dest, Uint16 len)
+{
+	size_t n;
+	if(c->list_pos >= c->list_size)
+		return 0;
+	n = c->list_size - c->list_pos;
+	if(n > len) {
+		/* stop after the last line that fits */
+		for(n = len; n && c->list[c->list_pos + n - 1] != '\n'; n--)
+			;
+	}
+	memcpy(dest, c->list + c->list_pos, n);
+	c->list_pos += n;
+	return n;
 }
 
 static Uint16
@@ -89,6 +355,7 @@ file_init(UxnFile *c, char *filename, size_t max_len)
 	char *p = c->current_filename;
 	size_t len = sizeof(c->current_filename);
 	reset(c);
+	c->seek = 0;
 	if(len > max_len) len = max_len;
 	while(len) {
 		if((*p++ = *filename++) == '\0')
@@ -102,13 +369,20 @@ file_init(UxnFile *c, char *filename, size_t max_len)
 static Uint16
 file_read(UxnFile *c, void *dest, Uint16 len)
 {
-	if(c->state != FILE_READ && c->state != DIR_READ) {
+	if(c->state != FILE_READ && c->state != DIR_READ && c->state != MAP_READ) {
 		reset(c);
-		if((c->dir = opendir(c->current_filename)) != NULL)
-			c->state = DIR_READ;
+		if(file_map(c))
+			c->pos = c->seek ? (size_t)c->offset : 0;
+		else if(file_list(c))
+			c->list_pos = c->seek ? (size_t)c->offset : 0;
 		else if((c->f = fopen(c->current_filename, "rb")) != NULL)
 			c->state = FILE_READ;
+		if(c->state == FILE_READ && c->seek)
+			fseek(c->f, c->offset, SEEK_SET);
+		c->seek = 0;
 	}
+	if(c->state == MAP_READ)
+		return file_read_map(c, dest, len);
 	if(c->state == FILE_READ)
 		return fread(dest, 1, len, c->f);
 	if(c->state == DIR_READ)
@@ -121,17 +395,54 @@ file_write(UxnFile *c, void *src, Uint16 len, Uint8 flags)
 {
 	Uint16 ret = 0;
 	if(c->state != FILE_WRITE) {
+		/* after a seek, write over the file from the offset rather than truncating it */
+		int over = c->seek && !(flags & 0x01);
 		reset(c);
-		if((c->f = fopen(c->current_filename, (flags & 0x01) ? "ab" : "wb")) != NULL)
+		if(over && (c->f = fopen(c->current_filename, "r+b")) == NULL)
+			over = 0;
+		if(!over)
+			c->f = file_open_write(c->current_filename, (flags & 0x01) ? "ab" : "wb");
+		if(c->f != NULL) {
+			if(flags & 0x02)
+				setvbuf(c->f, NULL, _IOFBF, WRITE_BACK);
+			if(over)
+				fseek(c->f, c->offset, SEEK_SET);
 			c->state = FILE_WRITE;
+		}
+		c->seek = 0;
 	}
 	if(c->state == FILE_WRITE) {
-		if((ret = fwrite(src, 1, len, c->f)) > 0 && fflush(c->f) != 0)
+		if((ret = fwrite(src, 1, len, c->f)) > 0 && !(flags & 0x02) && fflush(c->f) != 0)
 			ret = 0;
+		if(flags & 0x02)
+			c->dirty = 1;
+		else
+			file_changed();
 	}
 	return ret;
 }
 
+static Uint16
+file_seek(UxnFile *c, Uint8 *offset)
+{
+	unsigned long o = (unsigned long)offset[0] << 24 | (unsigned long)offset[1] << 16 | offset[2] << 8 | offset[3];
+	if(o > LONG_MAX)
+		return 0;
+	c->offset = o;
+	if(c->state == MAP_READ) {
+		c->pos = o;
+		return 1;
+	}
+	if(c->state == DIR_READ) {
+		c->list_pos = o;
+		return 1;
+	}
+	if(c->state == FILE_READ || c->state == FILE_WRITE)
+		return !fseek(c->f, c->offset, SEEK_SET);
+	c->seek = 1;
+	return 1;
+}
+
 static Uint16
 file_stat(UxnFile *c, void *dest, Uint16 len)
 {
@@ -140,69 +451,218 @@ file_stat(UxnFile *c, void *dest, Uint16 len)
 		basename++;
 	else
 		basename = c->current_filename;
-	return get_entry(dest, len, c->current_filename, basename, 0);
+	return get_entry(dest, len, c->current_filename, basename);
 }
 
 static Uint16
 file_delete(UxnFile *c)
 {
-	return unlink(c->current_filename);
+	int ret = unlink(c->current_filename);
+	file_changed();
+	return ret;
+}
+
+static Uint16
+file_request(UxnFile *c, Uint8 port, Uint8 *dest, Uint16 len, Uint8 flags)
+{
+	switch(port) {
+	case 0x5: return file_stat(c, dest, len);
+	case 0x6: return file_delete(c);
+	case 0xd: return file_read(c, dest, len);
+	case 0xf: return file_write(c, dest, len, flags);
+	}
+	return 0;
 }
 
 UxnFile *
 file_alloc(void)
 {
-	return calloc(1, sizeof(UxnFile));
+	UxnFile *c = calloc(1, sizeof(UxnFile));
+	if(c && pipe(c->notify)) {
+		free(c);
+		return NULL;
+	}
+	return c;
 }
 
 void
 file_free(UxnFile *file)
 {
+	if(file->started) {
+		pthread_mutex_lock(&file->lock);
+		file->quit = 1;
+		pthread_cond_signal(&file->cond);
+		pthread_mutex_unlock(&file->lock);
+		pthread_join(file->worker, NULL);
+	}
+	close(file->notify[0]), close(file->notify[1]);
 	reset(file);
+	file_unmap(file);
+	free(file->list);
 	free(file);
 }
 
+/* Async: with a vector set on the device, stat, delete, read and write run on
+a worker thread of their own, one at a time, and file_complete reports each
+result to port 0x2 before calling the vector. A new request made while the
+last one is in flight waits for it, and the result of the last one is held
+until its vector has run. The notify pipe holds a byte for every result that
+has yet to be reported. */
+
+static void *
+file_work(void *arg)
+{
+	UxnFile *c = arg;
+	Uint16 res;
+	pthread_mutex_lock(&c->lock);
+	while(1) {
+		while(c->job != QUEUED && !c->quit)
+			pthread_cond_wait(&c->cond, &c->lock);
+		if(c->quit)
+			break;
+		pthread_mutex_unlock(&c->lock);
+		res = file_request(c, c->port, c->ram + c->addr, c->len, c->flags);
+		pthread_mutex_lock(&c->lock);
+		c->res = res, c->job = DONE;
+		pthread_cond_signal(&c->cond);
+		if(write(c->notify[1], "", 1) != 1)
+			break;
+	}
+	pthread_mutex_unlock(&c->lock);
+	return NULL;
+}
+
+static int
+file_queue(UxnFile *c, Uint8 port, Uint8 *ram, Uint16 addr, Uint16 len, Uint8 flags)
+{
+	if(!c->started) {
+		pthread_mutex_init(&c->lock, NULL);
+		pthread_cond_init(&c->cond, NULL);
+		if(pthread_create(&c->worker, NULL, file_work, c))
+			return 0;
+		c->started = 1;
+	}
+	pthread_mutex_lock(&c->lock);
+	c->port = port, c->ram = ram, c->addr = addr, c->len = len, c->flags = flags;
+	c->job = QUEUED;
+	pthread_cond_signal(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+	return 1;
+}
+
+/* wait for the request in flight, and hold its result for the vector */
+static void
+file_finish(Uxn *u, UxnFile *c, int wait)
+{
+	char dropped;
+	if(!c->started)
+		return;
+	pthread_mutex_lock(&c->lock);
+	while(wait && c->job == QUEUED)
+		pthread_cond_wait(&c->cond, &c->lock);
+	if(c->job != DONE) {
+		pthread_mutex_unlock(&c->lock);
+		return;
+	}
+	c->job = NONE;
+	pthread_mutex_unlock(&c->lock);
+	if(c->port == 0x5 || c->port == 0xd)
+		uxn_invalidate(u, c->addr, c->res);
+	/* past RESULTS requests made within a single vector, the oldest goes */
+	if(c->count == RESULTS && read(c->notify[0], &dropped, 1) == 1)
+		c->first = (c->first + 1) % RESULTS, c->count--;
+	c->results[(c->first + c->count++) % RESULTS] = c->res;
+}
+
+int
+file_complete(Uxn *u, Uint8 *dat, UxnFile *c, int wait)
+{
+	char done;
+	Uint16 res;
+	file_finish(u, c, wait);
+	if(!c->count || read(c->notify[0], &done, 1) != 1)
+		return 0;
+	res = c->results[c->first];
+	c->first = (c->first + 1) % RESULTS, c->count--;
+	if(!GETVECTOR(dat))
+		return 1;
+	DEVPOKE16(dat, 0x2, res);
+	uxn_eval(u, GETVECTOR(dat));
+	return 1;
+}
+
+int
+file_fd(UxnFile *c)
+{
+	return c->notify[0];
+}
+
+/* Write-back: with bit 0x02 of the append port set when a file is opened for
+writing, writes gather in a buffer of WRITE_BACK bytes instead of reaching the
+file one by one. The buffer goes out when the file is closed, when the append
+port is written with bit 0x80 set, and at each frame through file_flush. */
+
+int
+file_flush(UxnFile *c)
+{
+	int busy = 0, ok;
+	if(c->started) {
+		pthread_mutex_lock(&c->lock);
+		busy = c->job == QUEUED;
+		pthread_mutex_unlock(&c->lock);
+	}
+	if(busy || c->state != FILE_WRITE)
+		return -1;
+	ok = fflush(c->f) == 0;
+	if(c->dirty)
+		file_changed(), c->dirty = 0;
+	return ok;
+}
+
 /* IO */
 
 void
 file_deo(Uxn *u, Uint8 *dat, UxnFile *c, Uint8 port)
 {
-	Uint16 addr, len, res;
+	Uint16 addr = 0, len, res;
+	int flushed;
+	/* ports that only hold a value leave the request in flight alone */
 	switch(port) {
-	case 0x5:
-		DEVPEEK16(addr, dat, 0x4);
-		DEVPEEK16(len, dat, 0xa);
-		if(len > 0x10000 - addr)
-			len = 0x10000 - addr;
-		res = file_stat(c, &u->ram[addr], len);
+	case 0x3:
+		file_finish(u, c, 1);
+		DEVPEEK16(addr, dat, 0x2);
+		res = addr <= 0xfffc ? file_seek(c, &u->ram[addr]) : 0;
 		DEVPOKE16(dat, 0x2, res);
-		break;
-	case 0x6:
-		res = file_delete(c);
-		DEVPOKE16(dat, 0x2, res);
-		break;
+		return;
+	case 0x5: DEVPEEK16(addr, dat, 0x4); break;
+	case 0x6: break;
+	case 0x7:
+		if(!(dat[0x7] & 0x80))
+			return;
+		file_finish(u, c, 1);
+		if((flushed = file_flush(c)) >= 0)
+			DEVPOKE16(dat, 0x2, flushed);
+		return;
 	case 0x9:
+		file_finish(u, c, 1);
 		DEVPEEK16(addr, dat, 0x8);
 		res = file_init(c, (char *)&u->ram[addr], 0x10000 - addr);
 		DEVPOKE16(dat, 0x2, res);
-		break;
-	case 0xd:
-		DEVPEEK16(addr, dat, 0xc);
-		DEVPEEK16(len, dat, 0xa);
-		if(len > 0x10000 - addr)
-			len = 0x10000 - addr;
-		res = file_read(c, &u->ram[addr], len);
-		DEVPOKE16(dat, 0x2, res);
-		break;
-	case 0xf:
-		DEVPEEK16(addr, dat, 0xe);
-		DEVPEEK16(len, dat, 0xa);
-		if(len > 0x10000 - addr)
-			len = 0x10000 - addr;
-		res = file_write(c, &u->ram[addr], len, dat[0x7]);
-		DEVPOKE16(dat, 0x2, res);
-		break;
+		return;
+	case 0xd: DEVPEEK16(addr, dat, 0xc); break;
+	case 0xf: DEVPEEK16(addr, dat, 0xe); break;
+	default: return;
 	}
+	file_finish(u, c, 1);
+	DEVPEEK16(len, dat, 0xa);
+	if(len > 0x10000 - addr)
+		len = 0x10000 - addr;
+	if(GETVECTOR(dat) && file_queue(c, port, u->ram, addr, len, dat[0x7]))
+		return;
+	res = file_request(c, port, &u->ram[addr], len, dat[0x7]);
+	if(port == 0x5 || port == 0xd)
+		uxn_invalidate(u, addr, res);
+	DEVPOKE16(dat, 0x2, res);
 }
 
 Uint8
@@ -212,6 +672,7 @@ file_dei(Uxn *u, Uint8 *dat, UxnFile *c, Uint8 port)
 	switch(port) {
 	case 0xc:
 	case 0xd:
+		file_finish(u, c, 1);
 		res = file_read(c, &dat[port], 1);
 		DEVPOKE16(dat, 0x2, res);
 		break;
@@ -229,6 +690,9 @@ load_rom(Uxn *u, char *filename)
 	memset(&uxn_file, 0, sizeof uxn_file);
 	file_init(&uxn_file, filename, strlen(filename) + 1);
 	ret = file_read(&uxn_file, &u->ram[PAGE_PROGRAM], 0x10000 - PAGE_PROGRAM);
+	uxn_invalidate(u, PAGE_PROGRAM, ret);
 	reset(&uxn_file);
+	file_unmap(&uxn_file);
+	free(uxn_file.list);
 	return ret;
 }
@@ -18,4 +18,7 @@ UxnFile *file_alloc(void);
 void file_free(UxnFile *file);
 void file_deo(Uxn *u, Uint8 *dat, UxnFile *c, Uint8 port);
 Uint8 file_dei(Uxn *u, Uint8 *dat, UxnFile *c, Uint8 port);
+int file_complete(Uxn *u, Uint8 *dat, UxnFile *c, int wait);
+int file_fd(UxnFile *c);
+int file_flush(UxnFile *c);
 int load_rom(Uxn *u, char *filename);
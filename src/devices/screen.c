@@ -1,4 +1,13 @@
 #include <stdlib.h>
+#include <string.h>
+#ifdef __unix__
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCREEN_X86
+#include <immintrin.h>
+#endif
 
 #include "screen.h"
 
@@ -21,6 +30,112 @@ static Uint8 blending[5][16] = {
 	{2, 3, 1, 2, 2, 3, 1, 2, 2, 3, 1, 2, 2, 3, 1, 2},
 	{1, 1, 1, 1, 1, 0, 1, 1, 1, 1, 0, 1, 1, 1, 1, 0}};
 
+#ifdef SCREEN_PACKED
+
+/* Packed layers hold two bitplanes, like 2bpp sprites, with the low and high
+bytes of each group of 8 pixels next to each other and bit 7 the leftmost. */
+
+#define COL(x) ((x) >> 3 << 1)
+#define ROW(w) COL((w) + 7)
+
+static void
+screen_write(UxnScreen *p, Layer *layer, Uint16 x, Uint16 y, Uint8 color)
+{
+	if(x < p->width && y < p->height) {
+		Uint8 *b = layer->pixels + y * ROW(p->width) + COL(x), bit = 0x80 >> (x & 7);
+		Uint8 lo = (b[0] & ~bit) | (color & 1 ? bit : 0), hi = (b[1] & ~bit) | (color & 2 ? bit : 0);
+		if(lo != b[0] || hi != b[1]) {
+			b[0] = lo, b[1] = hi;
+			screen_change(layer, x, y, x + 1, y + 1);
+		}
+	}
+}
+
+static void
+screen_fill(UxnScreen *p, Layer *layer, Uint16 x1, Uint16 y1, Uint16 x2, Uint16 y2, Uint8 color)
+{
+	Uint8 lo = color & 1 ? 0xff : 0x00, hi = color & 2 ? 0xff : 0x00, m, *b;
+	Uint16 x, y;
+	for(y = y1; y < y2; y++) {
+		b = layer->pixels + y * ROW(p->width) + COL(x1);
+		for(x = x1; x < x2; x = (x | 7) + 1, b += 2) {
+			m = 0xff >> (x & 7);
+			if(x2 - (x & ~7) < 8)
+				m &= 0xff << (8 - (x2 & 7));
+			b[0] = (b[0] & ~m) | (lo & m), b[1] = (b[1] & ~m) | (hi & m);
+		}
+	}
+}
+
+/* write the pixels of a row of 8 that are set in mask, from x on */
+static int
+screen_write8(UxnScreen *p, Layer *layer, int x, Uint16 y, Uint8 lo, Uint8 hi, Uint8 mask)
+{
+	Uint8 *b, m, l, h;
+	Uint16 m16, l16, h16;
+	int i, changed = 0;
+	if(x >= p->width)
+		return 0;
+	if(x < 0)
+		mask <<= -x, lo <<= -x, hi <<= -x, x = 0;
+	if(x + 8 > p->width)
+		mask &= 0xff << (x + 8 - p->width);
+	b = layer->pixels + y * ROW(p->width) + COL(x);
+	m16 = mask << 8 >> (x & 7), l16 = lo << 8 >> (x & 7), h16 = hi << 8 >> (x & 7);
+	for(i = 0; i < 4; i += 2, m16 <<= 8, l16 <<= 8, h16 <<= 8) {
+		if(!(m = m16 >> 8))
+			continue;
+		l = (b[i] & ~m) | (l16 >> 8 & m), h = (b[i + 1] & ~m) | (h16 >> 8 & m);
+		changed |= l != b[i] || h != b[i + 1];
+		b[i] = l, b[i + 1] = h;
+	}
+	return changed;
+}
+
+static Uint8
+reverse(Uint8 b)
+{
+	b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
+	b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
+	return (b & 0xaa) >> 1 | (b & 0x55) << 1;
+}
+
+static void
+screen_blit(UxnScreen *p, Layer *layer, Uint16 x, Uint16 y, Uint8 *sprite, Uint8 color, Uint8 flipx, Uint8 flipy, Uint8 twobpp)
+{
+	int v, ch, changed = 0, opaque = blending[4][color];
+	Uint8 lo, hi, c0, c1, m[4];
+	Uint16 row;
+	for(v = 0; v < 8; v++) {
+		row = y + (flipy ? 7 - v : v);
+		if(row >= p->height)
+			continue;
+		lo = sprite[v], hi = twobpp ? sprite[v + 8] : 0;
+		if(flipx)
+			lo = reverse(lo), hi = reverse(hi);
+		/* blend the 8 pixels at once, by the mask of each sprite color */
+		m[0] = ~(lo | hi), m[1] = lo & ~hi, m[2] = ~lo & hi, m[3] = lo & hi;
+		for(ch = 0, c0 = c1 = 0; ch < 4; ch++) {
+			if(blending[ch][color] & 1) c0 |= m[ch];
+			if(blending[ch][color] & 2) c1 |= m[ch];
+		}
+		changed |= screen_write8(p, layer, x, row, c0, c1, opaque ? 0xff : lo | hi);
+		if(x > 0xfff8)
+			changed |= screen_write8(p, layer, x - 0x10000, row, c0, c1, opaque ? 0xff : lo | hi);
+	}
+	if(changed)
+		screen_change(layer,
+			x > 0xfff8 ? 0 : x,
+			y > 0xfff8 ? 0 : y,
+			x > 0xfff8 ? x + 8 - 0x10000 : x + 8,
+			y > 0xfff8 ? y + 8 - 0x10000 : y + 8);
+}
+
+#else
+
+#define COL(x) (x)
+#define ROW(w) (w)
+
 static void
 screen_write(UxnScreen *p, Layer *layer, Uint16 x, Uint16 y, Uint8 color)
 {
@@ -28,29 +143,93 @@ screen_write(UxnScreen *p, Layer *layer, Uint16 x, Uint16 y, Uint8 color)
 		Uint32 i = x + y * p->width;
 		if(color != layer->pixels[i]) {
 			layer->pixels[i] = color;
-			layer->changed = 1;
+			screen_change(layer, x, y, x + 1, y + 1);
 		}
 	}
 }
 
 static void
-screen_blit(UxnScreen *p, Layer *layer, Uint16 x, Uint16 y, Uint8 *sprite, Uint8 color, Uint8 flipx, Uint8 flipy, Uint8 twobpp)
+screen_fill(UxnScreen *p, Layer *layer, Uint16 x1, Uint16 y1, Uint16 x2, Uint16 y2, Uint8 color)
+{
+	Uint16 y;
+	for(y = y1; y < y2; y++)
+		memset(layer->pixels + y * p->width + x1, color, x2 - x1);
+}
+
+/* Decoded sprites are cached by address and mode, as the layer colors of
+their 8x8 pixels and a mask of the drawn ones. An entry is only used while
+the sprite bytes it was decoded from are still the same in RAM. */
+
+#define CACHE 0x100
+
+typedef struct Sprite {
+	Uint8 *addr, mode, bytes[16], color[64], mask[64];
+} Sprite;
+
+static Sprite cache[CACHE];
+
+static Sprite *
+sprite_decode(Uint8 *sprite, Uint8 color, Uint8 flipx, Uint8 flipy, Uint8 twobpp)
 {
-	int v, h, opaque = blending[4][color];
+	Uint8 mode = 0x80 | (twobpp ? 0x40 : 0) | (flipy ? 0x20 : 0) | (flipx ? 0x10 : 0) | color, ch;
+	Sprite *e = &cache[((unsigned long)sprite >> 3 ^ mode * 0x1f) & (CACHE - 1)];
+	int v, h, opaque = blending[4][color], length = twobpp ? 16 : 8;
+	if(e->addr == sprite && e->mode == mode && !memcmp(e->bytes, sprite, length))
+		return e;
+	e->addr = sprite, e->mode = mode;
+	memcpy(e->bytes, sprite, length);
 	for(v = 0; v < 8; v++) {
 		Uint16 c = sprite[v] | (twobpp ? sprite[v + 8] : 0) << 8;
 		for(h = 7; h >= 0; --h, c >>= 1) {
-			Uint8 ch = (c & 1) | ((c >> 7) & 2);
-			if(opaque || ch)
-				screen_write(p,
-					layer,
-					x + (flipx ? 7 - h : h),
-					y + (flipy ? 7 - v : v),
-					blending[ch][color]);
+			int i = (flipy ? 7 - v : v) * 8 + (flipx ? 7 - h : h);
+			ch = (c & 1) | ((c >> 7) & 2);
+			e->color[i] = blending[ch][color];
+			e->mask[i] = opaque || ch ? 0xff : 0x00;
 		}
 	}
+	return e;
 }
 
+static void
+screen_blit(UxnScreen *p, Layer *layer, Uint16 x, Uint16 y, Uint8 *sprite, Uint8 color, Uint8 flipx, Uint8 flipy, Uint8 twobpp)
+{
+	int v, c, c1, c2, r1, r2, changed = 0, opaque = blending[4][color];
+	Uint8 *row, *src, *mask, b;
+	Sprite *e;
+	/* columns and rows that land on screen, wrapping past 0xffff */
+	if(x > 0xfff8)
+		c1 = 0x10000 - x, c2 = 0x10000 - x + p->width < 8 ? 0x10000 - x + p->width : 8;
+	else if(x < p->width)
+		c1 = 0, c2 = p->width - x < 8 ? p->width - x : 8;
+	else
+		return;
+	if(y > 0xfff8)
+		r1 = 0x10000 - y, r2 = 0x10000 - y + p->height < 8 ? 0x10000 - y + p->height : 8;
+	else if(y < p->height)
+		r1 = 0, r2 = p->height - y < 8 ? p->height - y : 8;
+	else
+		return;
+	e = sprite_decode(sprite, color, flipx, flipy, twobpp);
+	for(v = r1; v < r2; v++) {
+		row = layer->pixels + (Uint16)(y + v) * p->width + (Uint16)(x + c1);
+		src = e->color + v * 8 + c1, mask = e->mask + v * 8 + c1;
+		if(opaque) {
+			if(!changed && !memcmp(row, src, c2 - c1))
+				continue;
+			memcpy(row, src, c2 - c1), changed = 1;
+		} else
+			for(c = c1; c < c2; c++, row++, src++, mask++) {
+				b = (*row & ~*mask) | (*src & *mask);
+				changed |= *row ^ b;
+				*row = b;
+			}
+	}
+	if(changed)
+		screen_change(layer, (Uint16)(x + c1), (Uint16)(y + r1), (Uint16)(x + c1) + c2 - c1, (Uint16)(y + r1) + r2 - r1);
+}
+
+#endif
+
 void
 screen_palette(UxnScreen *p, Uint8 *addr)
 {
@@ -63,15 +242,15 @@ screen_palette(UxnScreen *p, Uint8 *addr)
 		p->palette[i] = 0x0f000000 | r << 16 | g << 8 | b;
 		p->palette[i] |= p->palette[i] << 4;
 	}
-	p->fg.changed = p->bg.changed = 1;
+	screen_change(&p->fg, 0, 0, p->width, p->height);
 }
 
 void
 screen_resize(UxnScreen *p, Uint16 width, Uint16 height)
 {
 	Uint8
-		*bg = realloc(p->bg.pixels, width * height),
-		*fg = realloc(p->fg.pixels, width * height);
+		*bg = realloc(p->bg.pixels, ROW(width) * height),
+		*fg = realloc(p->fg.pixels, ROW(width) * height);
 	Uint32
 		*pixels = realloc(p->pixels, width * height * sizeof(Uint32));
 	if(bg) p->bg.pixels = bg;
@@ -88,21 +267,267 @@ screen_resize(UxnScreen *p, Uint16 width, Uint16 height)
 void
 screen_clear(UxnScreen *p, Layer *layer)
 {
-	Uint32 i, size = p->width * p->height;
-	for(i = 0; i < size; i++)
-		layer->pixels[i] = 0x00;
-	layer->changed = 1;
+	memset(layer->pixels, 0, ROW(p->width) * p->height);
+	screen_change(layer, 0, 0, p->width, p->height);
+}
+
+void
+screen_copy(UxnScreen *dst, UxnScreen *src)
+{
+	Uint32 y, row = ROW(src->width), a, b;
+	Layer *damage = src->fg.changed ? &src->fg : &src->bg;
+	if(!damage->changed)
+		return;
+	if(src->bg.changed)
+		screen_change(damage, src->bg.x1, src->bg.y1, src->bg.x2, src->bg.y2);
+	if(damage->x2 > src->width) damage->x2 = src->width;
+	if(damage->y2 > src->height) damage->y2 = src->height;
+	a = COL(damage->x1), b = ROW(damage->x2);
+	for(y = damage->y1; y < damage->y2; y++) {
+		memcpy(dst->fg.pixels + y * row + a, src->fg.pixels + y * row + a, b - a);
+		memcpy(dst->bg.pixels + y * row + a, src->bg.pixels + y * row + a, b - a);
+	}
+	memcpy(dst->palette, src->palette, sizeof(dst->palette));
+	screen_change(&dst->fg, damage->x1, damage->y1, damage->x2, damage->y2);
+	src->fg.changed = src->bg.changed = 0;
+}
+
+void
+screen_change(Layer *layer, Uint16 x1, Uint16 y1, Uint16 x2, Uint16 y2)
+{
+	if(!layer->changed) {
+		layer->x1 = x1, layer->y1 = y1, layer->x2 = x2, layer->y2 = y2;
+		layer->changed = 1;
+		return;
+	}
+	if(x1 < layer->x1) layer->x1 = x1;
+	if(y1 < layer->y1) layer->y1 = y1;
+	if(x2 > layer->x2) layer->x2 = x2;
+	if(y2 > layer->y2) layer->y2 = y2;
+}
+
+/* Compositor: each row of the damaged box goes through a kernel mapping the
+fg << 2 | bg index of each pixel to the 16-entry palette. On x86, the widest
+of the SSE2, SSSE3 and AVX2 kernels that the CPU supports is picked on first
+use, and large boxes are split into bands of rows composited in threads. */
+
+#define BAND_PIXELS 0x40000
+#define BANDS 4
+
+/* composite columns x to x + n of a row, fg and bg point at the row */
+typedef void (*Kernel)(Uint32 *dst, Uint8 *fg, Uint8 *bg, Uint32 x, Uint32 n, Uint32 *palette);
+
+typedef struct Band {
+	UxnScreen *p;
+	Kernel kernel;
+	Uint32 *palette;
+	Uint16 y1, y2;
+} Band;
+
+#ifdef SCREEN_PACKED
+
+static void
+composite(Uint32 *dst, Uint8 *fg, Uint8 *bg, Uint32 x, Uint32 n, Uint32 *palette)
+{
+	Uint32 end = x + n, i;
+	Uint8 lo, hi, k;
+	while(x < end) {
+		/* a color is fg when it is set and bg otherwise */
+		i = COL(x), k = ~(fg[i] | fg[i + 1]);
+		lo = fg[i] | (bg[i] & k), hi = fg[i + 1] | (bg[i + 1] & k);
+		for(k = x & 7; k < 8 && x < end; k++, x++)
+			dst[x] = palette[(lo >> (7 - k) & 1) | (hi >> (7 - k) & 1) << 1];
+	}
+}
+
+#ifdef SCREEN_X86
+
+/* vpermd picks from the four colors, with the index of each pixel spread
+from the bits of a group of 8 */
+__attribute__((target("avx2"))) static void
+composite_avx2(Uint32 *dst, Uint8 *fg, Uint8 *bg, Uint32 x, Uint32 n, Uint32 *palette)
+{
+	Uint32 end = x + n, head = (8 - (x & 7)) & 7, i;
+	Uint8 lo, hi, k;
+	__m256i pal = _mm256_setr_epi32(palette[0], palette[1], palette[2], palette[3], 0, 0, 0, 0);
+	__m256i bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01), one = _mm256_set1_epi32(1), l, h;
+	if(head > n)
+		head = n;
+	composite(dst, fg, bg, x, head, palette);
+	for(x += head; x + 8 <= end; x += 8) {
+		i = x >> 2, k = ~(fg[i] | fg[i + 1]);
+		lo = fg[i] | (bg[i] & k), hi = fg[i + 1] | (bg[i + 1] & k);
+		l = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(lo), bits), bits), one);
+		h = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(hi), bits), bits), _mm256_set1_epi32(2));
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_permutevar8x32_epi32(pal, _mm256_or_si256(l, h)));
+	}
+	composite(dst, fg, bg, x, end - x, palette);
+}
+
+#endif
+
+#else
+
+static void
+composite(Uint32 *dst, Uint8 *fg, Uint8 *bg, Uint32 x, Uint32 n, Uint32 *palette)
+{
+	Uint32 i;
+	for(i = x; i < x + n; i++)
+		dst[i] = palette[fg[i] << 2 | bg[i]];
+}
+
+#ifdef SCREEN_X86
+
+/* a color index is fg when it is set and bg otherwise, so palette[0..3] holds
+the four colors, which SSE2 selects with compares on 4 pixels at a time */
+#define SELECT4(c) \
+	_mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_cmpeq_epi32(c, _mm_setzero_si128()), p0), _mm_and_si128(_mm_cmpeq_epi32(c, _mm_set1_epi32(1)), p1)), \
+		_mm_or_si128(_mm_and_si128(_mm_cmpeq_epi32(c, _mm_set1_epi32(2)), p2), _mm_and_si128(_mm_cmpeq_epi32(c, _mm_set1_epi32(3)), p3)))
+
+__attribute__((target("sse2"))) static void
+composite_sse2(Uint32 *dst, Uint8 *fg, Uint8 *bg, Uint32 x, Uint32 n, Uint32 *palette)
+{
+	Uint32 i;
+	__m128i zero = _mm_setzero_si128(), f, c, lo, hi;
+	__m128i p0 = _mm_set1_epi32(palette[0]), p1 = _mm_set1_epi32(palette[1]), p2 = _mm_set1_epi32(palette[2]), p3 = _mm_set1_epi32(palette[3]);
+	dst += x, fg += x, bg += x;
+	for(i = 0; i + 16 <= n; i += 16) {
+		f = _mm_loadu_si128((__m128i *)(fg + i));
+		c = _mm_or_si128(f, _mm_and_si128(_mm_cmpeq_epi8(f, zero), _mm_loadu_si128((__m128i *)(bg + i))));
+		lo = _mm_unpacklo_epi8(c, zero), hi = _mm_unpackhi_epi8(c, zero);
+		_mm_storeu_si128((__m128i *)(dst + i), SELECT4(_mm_unpacklo_epi16(lo, zero)));
+		_mm_storeu_si128((__m128i *)(dst + i + 4), SELECT4(_mm_unpackhi_epi16(lo, zero)));
+		_mm_storeu_si128((__m128i *)(dst + i + 8), SELECT4(_mm_unpacklo_epi16(hi, zero)));
+		_mm_storeu_si128((__m128i *)(dst + i + 12), SELECT4(_mm_unpackhi_epi16(hi, zero)));
+	}
+	composite(dst, fg, bg, i, n - i, palette);
+}
+
+/* pshufb looks up each byte of the 16 colors from its own table, the four
+bytes are then interleaved back into pixels */
+__attribute__((target("ssse3"))) static void
+composite_ssse3(Uint32 *dst, Uint8 *fg, Uint8 *bg, Uint32 x, Uint32 n, Uint32 *palette)
+{
+	Uint32 i, j;
+	Uint8 planes[4][16];
+	__m128i t0, t1, t2, t3, idx, b0, b1, b2, b3, lo01, hi01, lo23, hi23;
+	for(i = 0; i < 16; i++)
+		for(j = 0; j < 4; j++)
+			planes[j][i] = palette[i] >> (j * 8);
+	t0 = _mm_loadu_si128((__m128i *)planes[0]), t1 = _mm_loadu_si128((__m128i *)planes[1]);
+	t2 = _mm_loadu_si128((__m128i *)planes[2]), t3 = _mm_loadu_si128((__m128i *)planes[3]);
+	dst += x, fg += x, bg += x;
+	for(i = 0; i + 16 <= n; i += 16) {
+		/* fg is at most 3, shifting 16-bit lanes cannot carry across bytes */
+		idx = _mm_or_si128(_mm_slli_epi16(_mm_loadu_si128((__m128i *)(fg + i)), 2), _mm_loadu_si128((__m128i *)(bg + i)));
+		b0 = _mm_shuffle_epi8(t0, idx), b1 = _mm_shuffle_epi8(t1, idx);
+		b2 = _mm_shuffle_epi8(t2, idx), b3 = _mm_shuffle_epi8(t3, idx);
+		lo01 = _mm_unpacklo_epi8(b0, b1), hi01 = _mm_unpackhi_epi8(b0, b1);
+		lo23 = _mm_unpacklo_epi8(b2, b3), hi23 = _mm_unpackhi_epi8(b2, b3);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi16(lo01, lo23));
+		_mm_storeu_si128((__m128i *)(dst + i + 4), _mm_unpackhi_epi16(lo01, lo23));
+		_mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpacklo_epi16(hi01, hi23));
+		_mm_storeu_si128((__m128i *)(dst + i + 12), _mm_unpackhi_epi16(hi01, hi23));
+	}
+	composite(dst, fg, bg, i, n - i, palette);
+}
+
+/* vpermd picks from the four colors for 8 pixels at a time */
+__attribute__((target("avx2"))) static void
+composite_avx2(Uint32 *dst, Uint8 *fg, Uint8 *bg, Uint32 x, Uint32 n, Uint32 *palette)
+{
+	Uint32 i;
+	__m256i pal = _mm256_setr_epi32(palette[0], palette[1], palette[2], palette[3], 0, 0, 0, 0), f, c;
+	__m128i lo, hi;
+	dst += x, fg += x, bg += x;
+	for(i = 0; i + 32 <= n; i += 32) {
+		f = _mm256_loadu_si256((__m256i *)(fg + i));
+		c = _mm256_or_si256(f, _mm256_and_si256(_mm256_cmpeq_epi8(f, _mm256_setzero_si256()), _mm256_loadu_si256((__m256i *)(bg + i))));
+		lo = _mm256_castsi256_si128(c), hi = _mm256_extracti128_si256(c, 1);
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_permutevar8x32_epi32(pal, _mm256_cvtepu8_epi32(lo)));
+		_mm256_storeu_si256((__m256i *)(dst + i + 8), _mm256_permutevar8x32_epi32(pal, _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8))));
+		_mm256_storeu_si256((__m256i *)(dst + i + 16), _mm256_permutevar8x32_epi32(pal, _mm256_cvtepu8_epi32(hi)));
+		_mm256_storeu_si256((__m256i *)(dst + i + 24), _mm256_permutevar8x32_epi32(pal, _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8))));
+	}
+	composite(dst, fg, bg, i, n - i, palette);
+}
+
+#endif
+
+#endif
+
+static Kernel
+kernel(void)
+{
+#ifdef SCREEN_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) return composite_avx2;
+#ifndef SCREEN_PACKED
+	if(__builtin_cpu_supports("ssse3")) return composite_ssse3;
+	if(__builtin_cpu_supports("sse2")) return composite_sse2;
+#endif
+#endif
+	return composite;
+}
+
+static void *
+composite_band(void *arg)
+{
+	Band *b = arg;
+	UxnScreen *p = b->p;
+	Uint32 y, row = ROW(p->width);
+	for(y = b->y1; y < b->y2; y++)
+		b->kernel(p->pixels + y * p->width, p->fg.pixels + y * row, p->bg.pixels + y * row, p->x1, p->x2 - p->x1, b->palette);
+	return NULL;
 }
 
 void
 screen_redraw(UxnScreen *p)
 {
-	Uint32 *pixels = p->pixels;
-	Uint32 i, size = p->width * p->height, palette[16];
+	static Kernel k;
+	Uint32 i, n = 1, palette[16];
+	Band bands[BANDS];
+#ifdef __unix__
+	pthread_t threads[BANDS];
+	static long cpus;
+#endif
+	Layer *damage = p->fg.changed ? &p->fg : &p->bg;
+	p->x1 = p->y1 = p->x2 = p->y2 = 0;
+	if(!damage->changed)
+		return;
+	/* composite the union of both damaged boxes */
+	if(p->bg.changed)
+		screen_change(damage, p->bg.x1, p->bg.y1, p->bg.x2, p->bg.y2);
+	p->x1 = damage->x1, p->y1 = damage->y1;
+	p->x2 = damage->x2 < p->width ? damage->x2 : p->width;
+	p->y2 = damage->y2 < p->height ? damage->y2 : p->height;
 	for(i = 0; i < 16; i++)
 		palette[i] = p->palette[(i >> 2) ? (i >> 2) : (i & 3)];
-	for(i = 0; i < size; i++)
-		pixels[i] = palette[p->fg.pixels[i] << 2 | p->bg.pixels[i]];
+	if(!k)
+		k = kernel();
+#ifdef __unix__
+	if(!cpus)
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if((Uint32)(p->x2 - p->x1) * (p->y2 - p->y1) >= BAND_PIXELS && cpus > 1)
+		n = cpus < BANDS ? cpus : BANDS;
+#endif
+	for(i = 0; i < n; i++) {
+		bands[i].p = p, bands[i].kernel = k, bands[i].palette = palette;
+		bands[i].y1 = p->y1 + (p->y2 - p->y1) * i / n;
+		bands[i].y2 = p->y1 + (p->y2 - p->y1) * (i + 1) / n;
+	}
+#ifdef __unix__
+	/* the first band runs here, the others fall back to it if a thread fails */
+	for(i = 1; i < n; i++)
+		if(pthread_create(&threads[i], NULL, composite_band, &bands[i]))
+			composite_band(&bands[i]), bands[i].p = NULL;
+	composite_band(&bands[0]);
+	for(i = 1; i < n; i++)
+		if(bands[i].p)
+			pthread_join(threads[i], NULL);
+#else
+	composite_band(&bands[0]);
+#endif
 	p->fg.changed = p->bg.changed = 0;
 }
 
@@ -145,11 +570,22 @@ screen_deo(Uxn *u, UxnScreen *screen, Uint8 *dat, Uint8 port)
 		}
 		break;
 	case 0xe: {
-		Uint16 x, y;
-		Uint8 layer = dat[0xe] & 0x40;
+		Uint16 x, y, x2, y2;
+		Layer *layer = (dat[0xe] & 0x40) ? &screen->fg : &screen->bg;
 		DEVPEEK16(x, dat, 0x8);
 		DEVPEEK16(y, dat, 0xa);
-		screen_write(screen, layer ? &screen->fg : &screen->bg, x, y, dat[0xe] & 0x3);
+		if(dat[0xe] & 0x80) {
+			/* fill to the right and bottom edges, or to the left and top when flipped */
+			x2 = screen->width, y2 = screen->height;
+			if(dat[0xe] & 0x10) x2 = x < x2 ? x : x2, x = 0;
+			if(dat[0xe] & 0x20) y2 = y < y2 ? y : y2, y = 0;
+			if(x < x2 && y < y2) {
+				screen_fill(screen, layer, x, y, x2, y2, dat[0xe] & 0x3);
+				screen_change(layer, x, y, x2, y2);
+			}
+			break;
+		}
+		screen_write(screen, layer, x, y, dat[0xe] & 0x3);
 		if(dat[0x6] & 0x01) DEVPOKE16(dat, 0x8, x + 1); /* auto x+1 */
 		if(dat[0x6] & 0x02) DEVPOKE16(dat, 0xa, y + 1); /* auto y+1 */
 		break;
@@ -16,17 +16,21 @@ WITH REGARD TO THIS SOFTWARE.
 
 typedef struct Layer {
 	Uint8 *pixels, changed;
+	Uint16 x1, y1, x2, y2; /* damaged box, when changed */
 } Layer;
 
 typedef struct UxnScreen {
 	Uint32 palette[4], *pixels;
 	Uint16 width, height;
+	Uint16 x1, y1, x2, y2; /* box updated by the last redraw */
 	Layer fg, bg;
 } UxnScreen;
 
 void screen_palette(UxnScreen *p, Uint8 *addr);
 void screen_resize(UxnScreen *p, Uint16 width, Uint16 height);
 void screen_clear(UxnScreen *p, Layer *layer);
+void screen_change(Layer *layer, Uint16 x1, Uint16 y1, Uint16 x2, Uint16 y2);
+void screen_copy(UxnScreen *dst, UxnScreen *src);
 void screen_redraw(UxnScreen *p);
 
 Uint8 screen_dei(UxnScreen *screen, Uint8 *dat, Uint8 port);
@@ -56,7 +56,15 @@ system_deo(Uxn *u, Uint8 *dat, Uint8 port)
 	switch(port) {
 	case 0x2: u->wst = (Stack*)(u->ram + (dat[port] ? (dat[port] * 0x100) : 0x10000)); break;
 	case 0x3: u->rst = (Stack*)(u->ram + (dat[port] ? (dat[port] * 0x100) : 0x10100)); break;
-	case 0xe: system_inspect(u); break;
+	case 0xe:
+#ifdef UXN_PROFILE
+		if(dat[port] == 0x02) {
+			uxn_profile_dump(u);
+			break;
+		}
+#endif
+		system_inspect(u);
+		break;
 	default: system_deo_special(u, dat, port);
 	}
 }
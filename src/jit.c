@@ -0,0 +1,522 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "uxn.h"
+
+/*
+Copyright (c) 2022 Devine Lu Linvega, Andrew Alderwick, Andrew Richards
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+*/
+
+/* x86-64 translator for basic blocks of ram. Blocks end at jumps, BRK and
+before DEI/DEO, which run here in C so the dei/deo callbacks are unchanged.
+Native code keeps the stack pointers in r14/r15 and bails out to the
+interpreter before any instruction that would halt, so errors are reported
+exactly as uxn_interpret reports them. */
+
+#ifdef UXN_JIT
+
+#ifdef __x86_64__
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define CODE_SIZE 0x800000
+#define BLOCK_MAX 64
+#define BLOCK_ROOM 0x8000
+#define PATCH_MAX 0x1000
+
+enum { EXIT_NEXT,
+	EXIT_BRK,
+	EXIT_HALT,
+	EXIT_FLUSH };
+
+typedef Uint32 (*JitEnter)(Uxn *u, void *code);
+
+typedef struct {
+	Uint32 pos, value;
+} Patch;
+
+static struct {
+	Uint8 *code, codemap[0x10100], flush;
+	Uint32 len, base, exit, nstarts, npatches, nbails;
+	void *table[0x10000];
+	Uint16 starts[0x10000];
+	Patch patches[PATCH_MAX];
+	Patch bails[BLOCK_MAX * 4];
+	JitEnter enter;
+} jit;
+
+#define WST 0
+#define RST 1
+#define RAX 0
+#define RCX 1
+#define RDX 2
+
+/* Emitter */
+
+static void
+emit(int b)
+{
+	jit.code[jit.len++] = b;
+}
+
+static void
+emit32(Uint32 v)
+{
+	emit(v), emit(v >> 8), emit(v >> 16), emit(v >> 24);
+}
+
+static void
+emit64(void *p)
+{
+	size_t v = (size_t)p;
+	emit32(v), emit32(v >> 16 >> 16);
+}
+
+static void
+put32(Uint32 pos, Uint32 v)
+{
+	jit.code[pos] = v, jit.code[pos + 1] = v >> 8, jit.code[pos + 2] = v >> 16, jit.code[pos + 3] = v >> 24;
+}
+
+static void
+emit_jump(Uint32 to)
+{
+	emit(0xe9), emit32(to - (jit.len + 4));
+}
+
+static void
+emit_bail(int cc, Uint32 value)
+{
+	emit(0x0f), emit(0x80 | cc);
+	jit.bails[jit.nbails].pos = jit.len;
+	jit.bails[jit.nbails++].value = value;
+	emit32(0);
+}
+
+/* [r12 + r14 + disp] for the working stack, [r13 + r15 + disp] for the return stack */
+
+static void
+emit_stk(int op, int reg, int s, int disp)
+{
+	emit(0x43), emit(0x0f), emit(op), emit(0x44 | reg << 3), emit(s ? 0x3d : 0x34), emit(disp);
+}
+
+static void
+emit_swap16(int reg)
+{
+	emit(0x66), emit(0xc1), emit(0xc0 | reg), emit(0x08);
+}
+
+static void
+emit_pop(int reg, int s, int depth, int w)
+{
+	emit_stk(w == 2 ? 0xb7 : 0xb6, reg, s, -(depth + w));
+	if(w == 2) emit_swap16(reg);
+}
+
+static void
+emit_push(int reg, int s, int disp, int w)
+{
+	if(w == 2) {
+		emit(0x41), emit(0x89), emit(0xc0 | reg << 3);
+		emit(0x66), emit(0x41), emit(0xc1), emit(0xc0), emit(0x08);
+		emit(0x66), emit(0x47), emit(0x89), emit(0x44), emit(s ? 0x3d : 0x34), emit(disp);
+	} else
+		emit(0x43), emit(0x88), emit(0x44 | reg << 3), emit(s ? 0x3d : 0x34), emit(disp);
+}
+
+static void
+emit_move_sp(int s, int n)
+{
+	if(n) emit(0x41), emit(0x83), emit(s ? 0xc7 : 0xc6), emit(n);
+}
+
+static void
+emit_cmp_sp(int s, Uint32 v)
+{
+	emit(0x41), emit(0x81), emit(s ? 0xff : 0xfe), emit32(v);
+}
+
+static void
+emit_peek(int reg, int idx, int w)
+{
+	emit(0x0f), emit(w == 2 ? 0xb7 : 0xb6), emit(reg << 3 | 4), emit(idx << 3 | 3);
+	if(w == 2) emit_swap16(reg);
+}
+
+static void
+emit_poke(int reg, int idx, int w, Uint16 next)
+{
+	if(w == 2) {
+		emit(0x41), emit(0x89), emit(0xc0 | reg << 3);
+		emit(0x66), emit(0x41), emit(0xc1), emit(0xc0), emit(0x08);
+		emit(0x66), emit(0x44), emit(0x89), emit(0x04), emit(idx << 3 | 3);
+	} else
+		emit(0x88), emit(reg << 3 | 4), emit(idx << 3 | 3);
+	/* stores into translated code flush the cache after the store */
+	emit(0x49), emit(0xb9), emit64(jit.codemap);
+	emit(0x41), emit(0x80), emit(0x3c), emit(idx << 3 | 1), emit(0x00);
+	emit_bail(0x5, EXIT_FLUSH << 16 | next);
+	if(w == 2) {
+		emit(0x41), emit(0x80), emit(0x7c), emit(idx << 3 | 1), emit(0x01), emit(0x00);
+		emit_bail(0x5, EXIT_FLUSH << 16 | next);
+	}
+}
+
+static void
+emit_relative(Uint16 next)
+{
+	emit(0x0f), emit(0xbe), emit(0xc0);         /* movsx eax, al */
+	emit(0x05), emit32(next);                   /* add eax, next */
+	emit(0x0f), emit(0xb7), emit(0xc0);         /* movzx eax, ax */
+}
+
+/* Block linking */
+
+static void
+emit_link(Uint16 target)
+{
+	if(jit.table[target]) {
+		emit_jump((Uint8 *)jit.table[target] - jit.code);
+		return;
+	}
+	if(jit.npatches < PATCH_MAX) {
+		jit.patches[jit.npatches].pos = jit.len;
+		jit.patches[jit.npatches++].value = target;
+	}
+	emit(0xb8), emit32(target);
+	emit_jump(jit.exit);
+}
+
+static void
+emit_dynamic(void)
+{
+	emit(0x0f), emit(0xb7), emit(0xc0);         /* movzx eax, ax */
+	emit(0x48), emit(0xba), emit64(jit.table);  /* mov rdx, table */
+	emit(0x48), emit(0x8b), emit(0x14), emit(0xc2); /* mov rdx, [rdx + rax * 8] */
+	emit(0x48), emit(0x85), emit(0xd2);         /* test rdx, rdx */
+	emit(0x0f), emit(0x84), emit32(jit.exit - (jit.len + 4));
+	emit(0xff), emit(0xe2);                     /* jmp rdx */
+}
+
+static void
+resolve(Uint16 target)
+{
+	Uint32 i;
+	for(i = 0; i < jit.npatches;) {
+		if(jit.patches[i].value == target) {
+			Uint32 pos = jit.patches[i].pos;
+			jit.code[pos] = 0xe9;
+			put32(pos + 1, ((Uint8 *)jit.table[target] - jit.code) - (pos + 5));
+			jit.patches[i] = jit.patches[--jit.npatches];
+		} else
+			i++;
+	}
+}
+
+/* Translation */
+
+static void
+flush(void)
+{
+	Uint32 i;
+	for(i = 0; i < jit.nstarts; i++)
+		jit.table[jit.starts[i]] = NULL;
+	memset(jit.codemap, 0, sizeof(jit.codemap));
+	jit.nstarts = jit.npatches = jit.flush = 0;
+	jit.len = jit.base;
+}
+
+static void *
+translate(Uxn *u, Uint16 pc)
+{
+	int n, lit = 0, litw = 0, litr = 0;
+	Uint16 litv = 0, litpc = 0;
+	Uint32 i, start;
+	if(jit.len + BLOCK_ROOM > CODE_SIZE)
+		flush();
+	start = jit.len;
+	jit.nbails = 0;
+	jit.table[pc] = jit.code + start;
+	jit.starts[jit.nstarts++] = pc;
+	for(n = 0; n < BLOCK_MAX; n++) {
+		Uint8 instr = u->ram[pc], op = instr & 0x1f;
+		int w = instr & 0x20 ? 2 : 1, s = instr & 0x40 ? RST : WST, k = instr & 0x80;
+		int ina = w, inb = 0, inc = 0, outs = 0, outd = 0, nin, base, end = 0;
+		Uint16 here = pc, next;
+		if(op == 0x16 || op == 0x17)
+			break;
+		jit.codemap[pc] = 1;
+		next = pc + 1;
+		if(!instr) {
+			emit(0xb8), emit32(EXIT_BRK << 16 | here);
+			emit_jump(jit.exit);
+			end = 1;
+			break;
+		}
+		/* stack effect, in bytes */
+		switch(op) {
+		case 0x00: ina = 0, outs = w; break;
+		case 0x01: outs = w; break;
+		case 0x03: outs = w * 2; break;
+		case 0x04: inb = w, outs = w; break;
+		case 0x05: inb = w, outs = w * 2; break;
+		case 0x06: inb = w, outs = w * 3; break;
+		case 0x07: inb = w, inc = w, outs = w * 3; break;
+		case 0x08: case 0x09: case 0x0a: case 0x0b: inb = w, outs = 1; break;
+		case 0x0d: inb = 1; break;
+		case 0x0e: outd = 2; break;
+		case 0x0f: outd = w; break;
+		case 0x10: case 0x12: ina = 1, outs = w; break;
+		case 0x11: case 0x13: ina = 1, inb = w; break;
+		case 0x14: ina = 2, outs = w; break;
+		case 0x15: ina = 2, inb = w; break;
+		case 0x1f: ina = 1, inb = w, outs = w; break;
+		default:
+			if(op >= 0x18) inb = w, outs = w;
+		}
+		nin = ina + inb + inc;
+		base = k ? 0 : -nin;
+		if(nin) emit_cmp_sp(s, nin), emit_bail(0x2, EXIT_HALT << 16 | here);
+		if(base + outs > 0) emit_cmp_sp(s, 255 - (base + outs)), emit_bail(0x7, EXIT_HALT << 16 | here);
+		if(outd) emit_cmp_sp(!s, 255 - outd), emit_bail(0x7, EXIT_HALT << 16 | here);
+		if(ina) emit_pop(RAX, s, 0, ina);
+		if(inb) emit_pop(RCX, s, ina, inb);
+		if(inc) emit_pop(RDX, s, ina + inb, inc);
+		switch(op) {
+		case 0x00: /* LIT */
+			emit(0x0f), emit(w == 2 ? 0xb7 : 0xb6), emit(0x83), emit32(next);
+			if(w == 2) emit_swap16(RAX);
+			emit_push(RAX, s, 0, w);
+			lit = 2, litw = w, litr = s, litpc = next;
+			litv = w == 2 ? u->ram[next] << 8 | u->ram[next + 1] : u->ram[next];
+			next += w;
+			break;
+		case 0x01: emit(0x83), emit(0xc0), emit(0x01), emit_push(RAX, s, base, w); break;
+		case 0x02: break;
+		case 0x03: emit_push(RAX, s, base, w), emit_push(RAX, s, base + w, w); break;
+		case 0x04: emit_push(RAX, s, base, w); break;
+		case 0x05: emit_push(RAX, s, base, w), emit_push(RCX, s, base + w, w); break;
+		case 0x06: emit_push(RCX, s, base, w), emit_push(RAX, s, base + w, w), emit_push(RCX, s, base + w * 2, w); break;
+		case 0x07: emit_push(RCX, s, base, w), emit_push(RAX, s, base + w, w), emit_push(RDX, s, base + w * 2, w); break;
+		case 0x08: case 0x09: case 0x0a: case 0x0b:
+			emit(0x39), emit(0xc1);                                             /* cmp ecx, eax */
+			emit(0x0f), emit(op == 0x08 ? 0x94 : op == 0x09 ? 0x95 : op == 0x0a ? 0x97 : 0x92), emit(0xc0);
+			emit(0x0f), emit(0xb6), emit(0xc0);                                 /* movzx eax, al */
+			emit_push(RAX, s, base, 1);
+			break;
+		case 0x0c: case 0x0d: case 0x0e:
+			if(op == 0x0e) emit(0xba), emit32(next), emit_push(RDX, !s, 0, 2);
+			emit_move_sp(s, base), emit_move_sp(!s, outd);
+			if(op == 0x0d) {
+				Uint32 skip;
+				emit(0x85), emit(0xc9);                                         /* test ecx, ecx */
+				emit(0x0f), emit(0x84), skip = jit.len, emit32(0);
+				if(lit == 1 && litw == w && litr == s)
+					jit.codemap[litpc] = jit.codemap[litpc + 1] = 1, emit_link(w == 2 ? litv : (Uint16)(next + (Sint8)litv));
+				else {
+					if(w == 1) emit_relative(next);
+					emit_dynamic();
+				}
+				put32(skip, jit.len - (skip + 4));
+				emit_link(next);
+			} else if(lit == 1 && litw == w && litr == s)
+				jit.codemap[litpc] = jit.codemap[litpc + 1] = 1, emit_link(w == 2 ? litv : (Uint16)(next + (Sint8)litv));
+			else {
+				if(w == 1) emit_relative(next);
+				emit_dynamic();
+			}
+			end = 1;
+			break;
+		case 0x0f: emit_push(RAX, !s, 0, w); break;
+		case 0x10: emit_peek(RCX, RAX, w), emit_push(RCX, s, base, w); break;
+		case 0x11: case 0x13: case 0x15:
+			/* the pops are committed first, a store into code leaves the block */
+			emit_move_sp(s, base), base = 0;
+			if(op == 0x13) emit_relative(next);
+			emit_poke(RCX, RAX, w, next);
+			break;
+		case 0x12: emit_relative(next), emit_peek(RCX, RAX, w), emit_push(RCX, s, base, w); break;
+		case 0x14: emit_peek(RCX, RAX, w), emit_push(RCX, s, base, w); break;
+		case 0x18: emit(0x01), emit(0xc1), emit_push(RCX, s, base, w); break;              /* add ecx, eax */
+		case 0x19: emit(0x29), emit(0xc1), emit_push(RCX, s, base, w); break;              /* sub ecx, eax */
+		case 0x1a: emit(0x0f), emit(0xaf), emit(0xc8), emit_push(RCX, s, base, w); break;  /* imul ecx, eax */
+		case 0x1b:
+			emit(0x85), emit(0xc0), emit_bail(0x4, EXIT_HALT << 16 | here);             /* test eax, eax */
+			emit(0x89), emit(0xc6), emit(0x89), emit(0xc8), emit(0x31), emit(0xd2);    /* esi = eax, eax = ecx, edx = 0 */
+			emit(0xf7), emit(0xf6), emit_push(RAX, s, base, w);                         /* div esi */
+			break;
+		case 0x1c: emit(0x21), emit(0xc1), emit_push(RCX, s, base, w); break;              /* and ecx, eax */
+		case 0x1d: emit(0x09), emit(0xc1), emit_push(RCX, s, base, w); break;              /* or ecx, eax */
+		case 0x1e: emit(0x31), emit(0xc1), emit_push(RCX, s, base, w); break;              /* xor ecx, eax */
+		case 0x1f:
+			emit(0x89), emit(0xca), emit(0x89), emit(0xc1), emit(0x83), emit(0xe1), emit(0x0f); /* edx = ecx, ecx = eax & 0xf */
+			emit(0xd3), emit(0xea), emit(0x89), emit(0xc1), emit(0xc1), emit(0xe9), emit(0x04); /* shr edx, cl; ecx = eax >> 4 */
+			emit(0xd3), emit(0xe2), emit_push(RDX, s, base, w);                               /* shl edx, cl */
+			break;
+		}
+		if(end) break;
+		emit_move_sp(s, base + outs), emit_move_sp(!s, outd);
+		if(lit) lit--;
+		pc = next;
+	}
+	if(n == BLOCK_MAX)
+		emit_link(pc);
+	else if((u->ram[pc] & 0x1e) == 0x16)
+		emit(0xb8), emit32(pc), emit_jump(jit.exit);
+	/* side exits */
+	for(i = 0; i < jit.nbails; i++) {
+		put32(jit.bails[i].pos, jit.len - (jit.bails[i].pos + 4));
+		emit(0xb8), emit32(jit.bails[i].value);
+		emit_jump(jit.exit);
+	}
+	resolve(jit.starts[jit.nstarts - 1]);
+	return jit.code + start;
+}
+
+/* Entry and exit */
+
+static int
+init(void)
+{
+	static const Uint8 enter[] = {
+		0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57, /* push rbx, r12-r15 */
+		0x48, 0x8b, 0x9f, 0, 0, 0, 0,                         /* mov rbx, [rdi + ram] */
+		0x4c, 0x8b, 0xa7, 0, 0, 0, 0,                         /* mov r12, [rdi + wst] */
+		0x4c, 0x8b, 0xaf, 0, 0, 0, 0,                         /* mov r13, [rdi + rst] */
+		0x45, 0x0f, 0xb6, 0xb4, 0x24, 0xff, 0, 0, 0,          /* movzx r14d, byte [r12 + 255] */
+		0x45, 0x0f, 0xb6, 0xbd, 0xff, 0, 0, 0,                /* movzx r15d, byte [r13 + 255] */
+		0xff, 0xe6};                                          /* jmp rsi */
+	static const Uint8 leave[] = {
+		0x45, 0x88, 0xb4, 0x24, 0xff, 0, 0, 0,                /* mov [r12 + 255], r14b */
+		0x45, 0x88, 0xbd, 0xff, 0, 0, 0,                      /* mov [r13 + 255], r15b */
+		0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, /* pop r15-r12, rbx */
+		0xc3};
+	void *p;
+	int fd = open("/dev/zero", O_RDWR);
+	if(fd < 0)
+		return 0;
+	p = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED)
+		return 0;
+	jit.code = p;
+	memcpy(jit.code, enter, sizeof(enter));
+	put32(12, offsetof(Uxn, ram));
+	put32(19, offsetof(Uxn, wst));
+	put32(26, offsetof(Uxn, rst));
+	memcpy(&jit.enter, &p, sizeof(p));
+	jit.exit = sizeof(enter);
+	memcpy(jit.code + jit.exit, leave, sizeof(leave));
+	jit.len = jit.base = jit.exit + sizeof(leave);
+	return 1;
+}
+
+/* DEI and DEO, on the stacks as left by the native code */
+
+static int
+device(Uxn *u, Uint16 pc)
+{
+	Uint8 instr = u->ram[pc], port, bs = !!(instr & 0x20);
+	Stack *s = instr & 0x40 ? u->rst : u->wst;
+	int nin = instr & 0x01 ? 2 + bs : 1, nout = instr & 0x01 ? 0 : 1 + bs;
+	int ptr = s->ptr, base = instr & 0x80 ? ptr : ptr - nin;
+	if(ptr < nin || base + nout > 0xff)
+		return 0;
+	port = s->dat[ptr - 1];
+	if(instr & 0x01) {
+		Uint16 v = bs ? s->dat[ptr - 3] << 8 | s->dat[ptr - 2] : s->dat[ptr - 2];
+		s->ptr = base;
+		if(bs) {
+			u->deo(u, port, v >> 8);
+			u->deo(u, (port + 1) & 0xff, v);
+		} else
+			u->deo(u, port, v);
+	} else {
+		Uint16 v;
+		s->ptr = base;
+		v = u->dei(u, port);
+		if(bs) v = (v << 8) + u->dei(u, (port + 1) & 0xff);
+		if(bs) s->dat[s->ptr++] = v >> 8;
+		s->dat[s->ptr++] = v;
+	}
+	return 1;
+}
+
+void
+uxn_invalidate(Uxn *u, Uint16 addr, Uint16 len)
+{
+	(void)u;
+	if(!jit.flush && memchr(jit.codemap + addr, 1, len))
+		jit.flush = 1;
+}
+
+static int
+interpret(Uxn *u, Uint16 pc)
+{
+	/* the interpreter's stores do not consult the code map */
+	jit.flush = 1;
+	return uxn_interpret(u, pc);
+}
+
+int
+uxn_eval(Uxn *u, Uint16 pc)
+{
+	static int ready = -1;
+	if(!pc || u->dev[0][0xf]) return 0;
+	if(ready < 0) ready = init();
+	if(!ready) return uxn_interpret(u, pc);
+	for(;;) {
+		Uint32 res;
+		void *code;
+		if(u->wst != (Stack *)(u->ram + 0x10000) || u->rst != (Stack *)(u->ram + 0x10100))
+			return interpret(u, pc);
+		if(jit.flush)
+			flush();
+		if((u->ram[pc] & 0x1e) == 0x16) {
+			if(!device(u, pc))
+				return interpret(u, pc);
+			pc++;
+			continue;
+		}
+		if(!(code = jit.table[pc]))
+			code = translate(u, pc);
+		res = jit.enter(u, code);
+		pc = res;
+		switch(res >> 16) {
+		case EXIT_BRK: return 1;
+		case EXIT_HALT: return interpret(u, pc);
+		case EXIT_FLUSH: jit.flush = 1; break;
+		}
+	}
+}
+
+#else
+
+void
+uxn_invalidate(Uxn *u, Uint16 addr, Uint16 len)
+{
+	(void)u;
+	(void)addr;
+	(void)len;
+}
+
+int
+uxn_eval(Uxn *u, Uint16 pc)
+{
+	if(!pc || u->dev[0][0xf]) return 0;
+	return uxn_interpret(u, pc);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "uxn.h"
+
+/*
+Copyright (c) 2022 Devine Lu Linvega, Andrew Alderwick, Andrew Richards
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+*/
+
+/* Profiler for the interpreter. Frames form a tree rooted at each vector, a
+JSR enters a child frame of the current one and a JMP2r goes back to its
+parent, so the folded stacks follow the calls of a ROM as long as it returns
+the usual way. Frame 0 collects whatever runs outside of uxn_eval. */
+
+#ifdef UXN_PROFILE
+
+#define FOLDED "uxn.folded"
+#define HOTTEST 32
+
+UxnProfile uxn_profile;
+
+static Uint16 links[0x8000], order[0x10000];
+
+static const char *names[] = {
+	"LIT", "INC", "POP", "DUP", "NIP", "SWP", "OVR", "ROT",
+	"EQU", "NEQ", "GTH", "LTH", "JMP", "JCN", "JSR", "STH",
+	"LDZ", "STZ", "LDR", "STR", "LDA", "STA", "DEI", "DEO",
+	"ADD", "SUB", "MUL", "DIV", "AND", "ORA", "EOR", "SFT"};
+
+static Uint16
+frame_find(Uint16 parent, Uint16 addr)
+{
+	UxnProfile *p = &uxn_profile;
+	Uint32 h = (parent * 0x9e37 + addr) & 0x7fff;
+	UxnFrame *f;
+	while(links[h]) {
+		f = &p->frames[links[h]];
+		if(f->parent == parent && f->addr == addr)
+			return links[h];
+		h = (h + 1) & 0x7fff;
+	}
+	if(p->length == 0x3fff)
+		return p->frame;
+	links[h] = ++p->length;
+	f = &p->frames[p->length];
+	f->addr = addr, f->parent = parent;
+	return p->length;
+}
+
+void
+uxn_profile_enter(Uint16 addr)
+{
+	uxn_profile.frame = frame_find(0, addr);
+	uxn_profile.frames[uxn_profile.frame].calls++;
+}
+
+void
+uxn_profile_call(Uint16 addr)
+{
+	uxn_profile.frame = frame_find(uxn_profile.frame, addr);
+	uxn_profile.frames[uxn_profile.frame].calls++;
+}
+
+void
+uxn_profile_return(void)
+{
+	UxnFrame *f = &uxn_profile.frames[uxn_profile.frame];
+	if(f->parent)
+		uxn_profile.frame = f->parent;
+}
+
+static char *
+opcode_name(Uint8 op, char *buf)
+{
+	char *s = buf;
+	const char *n = op ? names[op & 0x1f] : "BRK";
+	while(*n)
+		*s++ = *n++;
+	if(op & 0x20) *s++ = '2';
+	if(op & 0x80 && op & 0x1f) *s++ = 'k';
+	if(op & 0x40) *s++ = 'r';
+	*s = 0;
+	return buf;
+}
+
+static const char *
+vector_name(Uxn *u, Uint16 addr)
+{
+	if(addr == PAGE_PROGRAM) return "reset";
+	if(addr == GETVECTOR(u->dev[0x1])) return "console";
+	if(addr == GETVECTOR(u->dev[0x2])) return "screen";
+	if(addr == GETVECTOR(u->dev[0x8])) return "controller";
+	if(addr == GETVECTOR(u->dev[0x9])) return "mouse";
+	return 0;
+}
+
+static int
+by_op(const void *a, const void *b)
+{
+	Uint32 x = uxn_profile.ops[*(Uint16 *)a], y = uxn_profile.ops[*(Uint16 *)b];
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int
+by_hits(const void *a, const void *b)
+{
+	Uint32 x = uxn_profile.hits[*(Uint16 *)a], y = uxn_profile.hits[*(Uint16 *)b];
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void
+fold(FILE *f, Uxn *u, Uint16 i)
+{
+	UxnFrame *fr = &uxn_profile.frames[i];
+	const char *name;
+	if(fr->parent) {
+		fold(f, u, fr->parent);
+		fprintf(f, ";0x%04x", fr->addr);
+	} else if((name = vector_name(u, fr->addr)))
+		fprintf(f, "%s@0x%04x", name, fr->addr);
+	else
+		fprintf(f, "0x%04x", fr->addr);
+}
+
+void
+uxn_profile_dump(Uxn *u)
+{
+	UxnProfile *p = &uxn_profile;
+	Uint32 i, n, total = 0, *steps;
+	Uint16 *root;
+	const char *name;
+	char buf[8];
+	FILE *f;
+	for(i = 0; i < 0x100; i++)
+		total += p->ops[i];
+	if(!total) return;
+	steps = calloc(p->length + 1, sizeof(Uint32));
+	root = calloc(p->length + 1, sizeof(Uint16));
+	if(!steps || !root) {
+		free(steps), free(root);
+		return;
+	}
+	/* children are always created after their parent */
+	for(i = 1; i <= p->length; i++) {
+		root[i] = p->frames[i].parent ? root[p->frames[i].parent] : i;
+		steps[root[i]] += p->frames[i].steps;
+	}
+	fprintf(stderr, "Profile: %u instructions\n", (unsigned)total);
+	for(i = 1; i <= p->length; i++) {
+		if(root[i] != i) continue;
+		name = vector_name(u, p->frames[i].addr);
+		fprintf(stderr, "  %-10s 0x%04x %10u calls %12u steps %10u avg\n", name ? name : "vector", p->frames[i].addr, (unsigned)p->frames[i].calls, (unsigned)steps[i], (unsigned)(p->frames[i].calls ? steps[i] / p->frames[i].calls : 0));
+	}
+	for(i = 0; i < 0x100; i++)
+		order[i] = i;
+	qsort(order, 0x100, sizeof(Uint16), by_op);
+	fprintf(stderr, "Opcodes:\n");
+	for(i = 0; i < 0x100 && p->ops[order[i]]; i++)
+		fprintf(stderr, "  %-7s %12u %6.2f%%\n", opcode_name(order[i], buf), (unsigned)p->ops[order[i]], p->ops[order[i]] * 100.0 / total);
+	for(i = 0, n = 0; i < 0x10000; i++)
+		if(p->hits[i]) order[n++] = i;
+	qsort(order, n, sizeof(Uint16), by_hits);
+	fprintf(stderr, "Hottest:\n");
+	for(i = 0; i < n && i < HOTTEST; i++)
+		fprintf(stderr, "  0x%04x  %-7s %12u %6.2f%%\n", order[i], opcode_name(u->ram[order[i]], buf), (unsigned)p->hits[order[i]], p->hits[order[i]] * 100.0 / total);
+	if((f = fopen(FOLDED, "w"))) {
+		for(i = 1; i <= p->length; i++) {
+			if(!p->frames[i].steps) continue;
+			fold(f, u, i);
+			fprintf(f, " %u\n", (unsigned)p->frames[i].steps);
+		}
+		fclose(f);
+		fprintf(stderr, "Folded stacks written to %s\n", FOLDED);
+	}
+	free(steps), free(root);
+}
+
+#endif
@@ -1,5 +1,9 @@
 #include "uxn.h"
 
+#if defined(UXN_JIT) || defined(UXN_AOT)
+#define uxn_eval uxn_interpret
+#endif
+
 /*
 Copyright (u) 2022 Devine Lu Linvega, Andrew Alderwick, Andrew Richards
 
@@ -26,14 +30,49 @@ WITH REGARD TO THIS SOFTWARE.
 #define DEVW(x, y) { if (bs) { u->deo(u, (x), (y) >> 8); u->deo(u, ((x) + 1) & 0xFF, (y)); } else { u->deo(u, x, (y)); } }
 #define WARP(x) { if(bs) pc = (x); else pc += (Sint8)(x); }
 
+#ifdef UXN_PROFILE
+#define PROFILE_ENTER(x) uxn_profile_enter(x);
+#define PROFILE_STEP(x, o) { uxn_profile.ops[(o)]++; uxn_profile.hits[(Uint16)(x)]++; uxn_profile.frames[uxn_profile.frame].steps++; }
+#define PROFILE_CALL(x) uxn_profile_call(x);
+#define PROFILE_RETURN(c) { if(c) uxn_profile_return(); }
+#else
+#define PROFILE_ENTER(x)
+#define PROFILE_STEP(x, o)
+#define PROFILE_CALL(x)
+#define PROFILE_RETURN(c)
+#endif
+
+#if defined(UXN_PROFILE) && (defined(UXN_PREDECODE) || defined(UXN_JIT) || defined(UXN_AOT))
+#error "UXN_PROFILE counts the interpreter, it cannot be combined with UXN_PREDECODE, UXN_JIT or UXN_AOT"
+#endif
+
+#if defined(UXN_PREDECODE) && (defined(UXN_REGCACHE) || defined(UXN_JIT) || defined(UXN_AOT))
+#error "UXN_PREDECODE cannot be combined with UXN_REGCACHE, UXN_JIT or UXN_AOT"
+#endif
+
+#if (defined(UXN_REGCACHE) || defined(UXN_PREDECODE)) && !defined(UXN_THREADED)
+#define UXN_THREADED
+#endif
+
+#if !defined(UXN_THREADED) || defined(UXN_REGCACHE) || defined(UXN_PREDECODE)
+
+#if defined(UXN_REGCACHE) || defined(UXN_PREDECODE)
+static int
+uxn_eval_plain(Uxn *u, Uint16 pc)
+#else
 int
 uxn_eval(Uxn *u, Uint16 pc)
+#endif
 {
 	unsigned int a, b, c, j, k, bs, instr, errcode;
 	Uint8 kptr, *sp;
 	Stack *src, *dst;
+#if !defined(UXN_REGCACHE) && !defined(UXN_PREDECODE) && !defined(UXN_JIT) && !defined(UXN_AOT)
 	if(!pc || u->dev[0][0xf]) return 0;
+	PROFILE_ENTER(pc)
+#endif
 	while((instr = u->ram[pc++])) {
+		PROFILE_STEP(pc - 1, instr)
 		/* Return Mode */
 		if(instr & 0x40) {
 			src = u->rst; dst = u->wst;
@@ -65,9 +104,9 @@ uxn_eval(Uxn *u, Uint16 pc)
 		case 0x09: /* NEQ */ POP(a) POP(b) PUSH8(src, b != a) break;
 		case 0x0a: /* GTH */ POP(a) POP(b) PUSH8(src, b > a) break;
 		case 0x0b: /* LTH */ POP(a) POP(b) PUSH8(src, b < a) break;
-		case 0x0c: /* JMP */ POP(a) WARP(a) break;
+		case 0x0c: /* JMP */ POP(a) WARP(a) PROFILE_RETURN(instr == 0x6c) break;
 		case 0x0d: /* JCN */ POP(a) POP8(b) if(b) WARP(a) break;
-		case 0x0e: /* JSR */ POP(a) PUSH16(dst, pc) WARP(a) break;
+		case 0x0e: /* JSR */ POP(a) PUSH16(dst, pc) WARP(a) PROFILE_CALL(pc) break;
 		case 0x0f: /* STH */ POP(a) PUSH(dst, a) break;
 		/* Memory */
 		case 0x10: /* LDZ */ POP8(a) PEEK(b, a) PUSH(src, b) break;
@@ -98,6 +137,315 @@ err:
 	return uxn_halt(u, errcode, pc - 1);
 }
 
+#endif
+
+#ifdef UXN_THREADED
+
+/* Threaded engine: each opcode body is expanded once per mode, with bs, _r and
+_k as constants so the mode decoding folds away at compile time. GCC and clang
+jump through a table of label addresses, other compilers use a flat switch. */
+
+#if defined(__GNUC__) && !defined(UXN_NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define ENTRY(label, v) label:
+#define DISPATCH { instr = u->ram[pc++]; goto *table[instr]; }
+#else
+#define ENTRY(label, v) case v:
+#define DISPATCH break;
+#endif
+
+#ifdef UXN_REGCACHE
+
+/* Register cache: the stack pointers and the top byte of the working stack live
+in locals for the whole run. Pops are counted in kn and only applied at the
+first push, tv tells whether t holds the top of the working stack. The Stack
+structs are brought up to date around DEI/DEO, on halt and on return. Once a
+stack is relocated into addressable RAM, the rest of the vector runs on the
+plain engine, so memory accesses always see the real stacks. */
+
+#undef PUSH8
+#undef PUSH16
+#undef POP8
+#undef POP16
+#undef DEVR
+#undef DEVW
+#define MODE(label, v, m2, mr, mk, body) ENTRY(label, v) { enum { bs = m2, _r = mr, _k = mk }; PROFILE_STEP(pc - 1, v) kn = 0; tv = 1; body COMMIT if(!tv) t = wd[(Uint8)(wp - 1)]; } DISPATCH
+#define COMMIT { if(!_k) { if(_r) rp -= kn; else if(kn) { wp -= kn; tv = 0; } } kn = 0; }
+#define SYNC { if(tv) wd[(Uint8)(wp - 1)] = t; u->wst->ptr = wp; u->rst->ptr = rp; }
+#define RELOAD { wd = u->wst->dat; rd = u->rst->dat; wp = u->wst->ptr; rp = u->rst->ptr; tv = 0; }
+#define MAPPED (u->wst != (Stack *)(u->ram + 0x10000) || u->rst != (Stack *)(u->ram + 0x10100))
+#define RESUME { if(MAPPED) { SYNC return uxn_eval_plain(u, pc); } }
+#define HALT(c) { errcode = c; COMMIT SYNC goto err; }
+#define WPEEK(i) ((i) ? wd[(Uint8)(wp - 1 - (i))] : t)
+#define WPUSH8(x) { COMMIT if(wp == 0xff) HALT(2) if(tv) wd[(Uint8)(wp - 1)] = t; t = (x); tv = 1; wp++; }
+#define WPUSH16(x) { COMMIT if(wp >= 0xfe) HALT(2) k = (x); if(tv) wd[(Uint8)(wp - 1)] = t; wd[wp] = k >> 8; t = k; tv = 1; wp += 2; }
+#define RPUSH8(x) { COMMIT if(rp == 0xff) HALT(2) rd[rp++] = (x); }
+#define RPUSH16(x) { COMMIT if(rp >= 0xfe) HALT(2) k = (x); rd[rp] = k >> 8; rd[rp + 1] = k; rp += 2; }
+#define PUSH8(s, x) PUSH8_##s(x)
+#define PUSH16(s, x) PUSH16_##s(x)
+#define PUSH8_src(x) { if(_r) RPUSH8(x) else WPUSH8(x) }
+#define PUSH8_dst(x) { if(_r) WPUSH8(x) else RPUSH8(x) }
+#define PUSH16_src(x) { if(_r) RPUSH16(x) else WPUSH16(x) }
+#define PUSH16_dst(x) { if(_r) WPUSH16(x) else RPUSH16(x) }
+#define POP8(o) { if((_r ? rp : wp) <= kn) HALT(0) o = _r ? rd[(Uint8)(rp - 1 - kn)] : WPEEK(kn); kn++; }
+#define POP16(o) { if((_r ? rp : wp) <= kn + 1) HALT(0) o = _r ? rd[(Uint8)(rp - 1 - kn)] | rd[(Uint8)(rp - 2 - kn)] << 8 : WPEEK(kn) | WPEEK(kn + 1) << 8; kn += 2; }
+#define DEVR(o, x) { COMMIT SYNC o = u->dei(u, x); if (bs) o = (o << 8) + u->dei(u, ((x) + 1) & 0xFF); RELOAD }
+#define DEVW(x, y) { COMMIT SYNC if (bs) { u->deo(u, (x), (y) >> 8); u->deo(u, ((x) + 1) & 0xFF, (y)); } else { u->deo(u, x, (y)); } RELOAD }
+
+#else
+
+#define MODE(label, v, m2, mr, mk, body) ENTRY(label, v) { enum { bs = m2, _r = mr, _k = mk }; PROFILE_STEP(pc - 1, v) SELECT body } DISPATCH
+#define SELECT { src = _r ? u->rst : u->wst; dst = _r ? u->wst : u->rst; if(_k) { kptr = src->ptr; sp = &kptr; } else sp = &src->ptr; }
+#define HALT(c) { errcode = c; goto err; }
+#define RESUME
+
+#endif
+
+#ifdef UXN_PREDECODE
+
+/* Pre-decoding: pre.op holds, per address, one plus the opcode found there, or
+the id of a superinstruction fusing it with the instructions that follow, so
+DISPATCH is a single load. Zero sends the address through DECODE first. A
+superinstruction keeps its literals in pre.imm and pre.aux and checks the stack
+bounds of the whole sequence upfront, when that fails its first opcode runs on
+its own so errors are raised at the same address. Plain entries read their
+literals from ram, a store into a page holding decoded code forgets the entries
+that may cover the written byte. Relocated stacks run on the plain engine. */
+
+#define LITOPS(X) \
+	X(EQU, 0x08, ==, 1) X(NEQ, 0x09, !=, 1) X(GTH, 0x0a, >, 1) X(LTH, 0x0b, <, 1) X(ADD, 0x18, +, 0) \
+	X(SUB, 0x19, -, 0) X(MUL, 0x1a, *, 0) X(AND, 0x1c, &, 0) X(ORA, 0x1d, |, 0) X(EOR, 0x1e, ^, 0)
+#define LITOP_ID(n, o, e, cmp) FUSE_LIT_##n, FUSE_LIT2_##n,
+#define LITOP_CASE(n, o, e, cmp) \
+	case o: if(m[0] == 0x80) id = FUSE_LIT_##n, len = 3, imm = m[1]; break; \
+	case o | 0x20: if(m[0] == 0xa0) id = FUSE_LIT2_##n, len = 4, imm = m[1] << 8 | m[2]; break;
+
+enum {
+	FUSE_DEO = 0x100, FUSE_DEO2, FUSE_JMP, FUSE_JCN, FUSE_JSR, FUSE_JMP2, FUSE_JCN2, FUSE_JSR2,
+	FUSE_DUP2ADD2, FUSE_INC2DUP2LDA, LITOPS(LITOP_ID) FUSE_END };
+
+static struct {
+	Uint8 *ram, aux[0x10000], page[0x100];
+	Uint16 op[0x10000], imm[0x10000];
+} pre;
+
+static void
+predecode(Uint8 *ram, Uint16 pc)
+{
+	Uint8 *m = ram + pc;
+	unsigned int i, id = m[0], len = 1, imm = 0, aux = 0;
+	if(pc < 0xfffa) {
+		if(m[0] == 0xa0 && m[3] == 0x80 && m[5] == 0x37)
+			id = FUSE_DEO2, len = 6, imm = m[1] << 8 | m[2], aux = m[4];
+		else if(m[0] == 0x80 && m[2] == 0x80 && m[4] == 0x17)
+			id = FUSE_DEO, len = 5, imm = m[1], aux = m[3];
+		else if(m[0] == 0x80 && m[2] >= 0x0c && m[2] <= 0x0e)
+			id = FUSE_JMP + m[2] - 0x0c, len = 3, imm = (pc + 3 + (Sint8)m[1]) & 0xffff;
+		else if(m[0] == 0xa0 && m[3] >= 0x2c && m[3] <= 0x2e)
+			id = FUSE_JMP2 + m[3] - 0x2c, len = 4, imm = m[1] << 8 | m[2];
+		else if(m[0] == 0x23 && m[1] == 0x38)
+			id = FUSE_DUP2ADD2, len = 2;
+		else if(m[0] == 0x21 && m[1] == 0x23 && m[2] == 0x14)
+			id = FUSE_INC2DUP2LDA, len = 3;
+		else if(m[0] == 0x80)
+			switch(m[2]) { LITOPS(LITOP_CASE) }
+		else if(m[0] == 0xa0)
+			switch(m[3]) { LITOPS(LITOP_CASE) }
+	}
+	pre.op[pc] = id + 1, pre.imm[pc] = imm, pre.aux[pc] = aux;
+	for(i = 0; i < len; i++)
+		pre.page[(pc + i) >> 8] = 1;
+}
+
+static void
+forget(Uint16 addr)
+{
+	unsigned int i;
+	for(i = 0; i < 6 && i <= addr; i++)
+		if(!i || pre.op[addr - i] > 0x100)
+			pre.op[addr - i] = 0;
+}
+
+void
+uxn_invalidate(Uxn *u, Uint16 addr, Uint16 len)
+{
+	Uint32 i;
+	if(u->ram == pre.ram)
+		for(i = addr; i < (Uint32)addr + len; i++) {
+			if(!pre.page[(i >> 8) & 0xff])
+				i |= 0xff;
+			else
+				forget(i);
+		}
+}
+
+#undef POKE
+#undef RESUME
+#undef DISPATCH
+#define FORGET(x) { if(pre.page[((x) >> 8) & 0xff]) forget(x); }
+#define POKE(x, y) { if(bs) { u->ram[(x)] = (y) >> 8; u->ram[(x) + 1] = (y); FORGET((x) + 1) } else { u->ram[(x)] = y; } FORGET(x) }
+#define MAPPED (u->wst != (Stack *)(u->ram + 0x10000) || u->rst != (Stack *)(u->ram + 0x10100))
+#define RESUME { if(MAPPED) { pre.ram = 0; return uxn_eval_plain(u, pc); } }
+#define FUSED(label, v, guard, body) ENTRY(label, v) { Stack *w = u->wst; if(!(guard)) UNFUSED body } DISPATCH
+#define LITOP_FUSED(n, o, e, cmp) \
+	FUSED(LIT_##n##_f, FUSE_LIT_##n, w->ptr && w->ptr < 0xff, k = w->ptr - 1; w->dat[k] = w->dat[k] e pre.imm[pc - 1]; pc += 2;) \
+	FUSED(LIT2_##n##_f, FUSE_LIT2_##n, w->ptr >= 2 && w->ptr < 0xfe, k = w->ptr; a = pre.imm[pc - 1]; b = w->dat[k - 2] << 8 | w->dat[k - 1]; \
+		if(cmp) { w->dat[k - 2] = b e a; w->ptr = k - 1; } else { c = b e a; w->dat[k - 2] = c >> 8; w->dat[k - 1] = c; } pc += 3;)
+#define LITOP_LABEL(n, o, e, cmp) &&LIT_##n##_f, &&LIT2_##n##_f,
+#ifdef COMPUTED_GOTO
+#define DISPATCH { goto *table[pre.op[pc++]]; }
+#define UNFUSED { goto *table[u->ram[pc - 1] + 1]; }
+#else
+#undef ENTRY
+#define ENTRY(label, v) case (v) + 1:
+#define DISPATCH break;
+#define UNFUSED { op = u->ram[pc - 1] + 1; goto redo; }
+#endif
+
+#endif
+
+#define OPC(name, o, body) \
+	MODE(name##_0, o, 0, 0, 0, body) MODE(name##_2, o | 0x20, 1, 0, 0, body) \
+	MODE(name##_r, o | 0x40, 0, 1, 0, body) MODE(name##_2r, o | 0x60, 1, 1, 0, body) \
+	MODE(name##_k, o | 0x80, 0, 0, 1, body) MODE(name##_2k, o | 0xa0, 1, 0, 1, body) \
+	MODE(name##_kr, o | 0xc0, 0, 1, 1, body) MODE(name##_2kr, o | 0xe0, 1, 1, 1, body)
+#define OPS(m) \
+	&&LIT##m, &&INC##m, &&POP##m, &&DUP##m, &&NIP##m, &&SWP##m, &&OVR##m, &&ROT##m, \
+	&&EQU##m, &&NEQ##m, &&GTH##m, &&LTH##m, &&JMP##m, &&JCN##m, &&JSR##m, &&STH##m, \
+	&&LDZ##m, &&STZ##m, &&LDR##m, &&STR##m, &&LDA##m, &&STA##m, &&DEI##m, &&DEO##m, \
+	&&ADD##m, &&SUB##m, &&MUL##m, &&DIV##m, &&AND##m, &&ORA##m, &&EOR##m, &&SFT##m
+#define IMM if(bs) { PEEK16(a, pc) PUSH16(src, a) pc += 2; } else { a = u->ram[pc]; PUSH8(src, a) pc++; }
+
+int
+uxn_eval(Uxn *u, Uint16 pc)
+{
+	unsigned int a, b, c, k, instr, errcode;
+#ifdef UXN_REGCACHE
+	unsigned int wp, rp, kn, tv;
+	Uint8 t, *wd, *rd;
+#else
+	unsigned int j;
+	Uint8 kptr, *sp;
+	Stack *src, *dst;
+#endif
+#if defined(UXN_PREDECODE) && !defined(COMPUTED_GOTO)
+	unsigned int op;
+#endif
+#if defined(UXN_PREDECODE) && defined(COMPUTED_GOTO)
+	static void *table[FUSE_END + 1] = {
+		&&DECODE, OPS(_0), OPS(_2), OPS(_r), OPS(_2r), OPS(_k), OPS(_2k), OPS(_kr), OPS(_2kr),
+		&&DEO_f, &&DEO2_f, &&JMP_f, &&JCN_f, &&JSR_f, &&JMP2_f, &&JCN2_f, &&JSR2_f,
+		&&DUP2ADD2_f, &&INC2DUP2LDA_f, LITOPS(LITOP_LABEL)};
+#elif defined(COMPUTED_GOTO)
+	static void *table[256] = {
+		OPS(_0), OPS(_2), OPS(_r), OPS(_2r), OPS(_k), OPS(_2k), OPS(_kr), OPS(_2kr)};
+#endif
+#if !defined(UXN_JIT) && !defined(UXN_AOT)
+	if(!pc || u->dev[0][0xf]) return 0;
+	PROFILE_ENTER(pc)
+#endif
+#ifdef UXN_REGCACHE
+	if(MAPPED) return uxn_eval_plain(u, pc);
+	RELOAD
+	t = wd[(Uint8)(wp - 1)];
+#endif
+#ifdef UXN_PREDECODE
+	if(MAPPED) {
+		pre.ram = 0;
+		return uxn_eval_plain(u, pc);
+	}
+	if(pre.ram != u->ram) {
+		for(k = 0; k < 0x10000; k++) pre.op[k] = 0;
+		for(k = 0; k < 0x100; k++) pre.page[k] = 0;
+		pre.ram = u->ram;
+	}
+#endif
+#ifdef COMPUTED_GOTO
+	DISPATCH
+#elif defined(UXN_PREDECODE)
+	for(;;) {
+		op = pre.op[pc++];
+	redo:
+		switch(op) {
+#else
+	for(;;) switch(instr = u->ram[pc++]) {
+#endif
+	ENTRY(LIT_0, 0x00) /* BRK */
+#ifdef UXN_REGCACHE
+	tv = 1;
+	SYNC
+#endif
+	return 1;
+	/* Stack */
+	MODE(LIT_2, 0x20, 1, 0, 0, IMM) MODE(LIT_r, 0x40, 0, 1, 0, IMM) MODE(LIT_2r, 0x60, 1, 1, 0, IMM)
+	MODE(LIT_k, 0x80, 0, 0, 1, IMM) MODE(LIT_2k, 0xa0, 1, 0, 1, IMM) MODE(LIT_kr, 0xc0, 0, 1, 1, IMM) MODE(LIT_2kr, 0xe0, 1, 1, 1, IMM)
+	OPC(INC, 0x01, POP(a) PUSH(src, a + 1))
+	OPC(POP, 0x02, POP(a))
+	OPC(DUP, 0x03, POP(a) PUSH(src, a) PUSH(src, a))
+	OPC(NIP, 0x04, POP(a) POP(b) PUSH(src, a))
+	OPC(SWP, 0x05, POP(a) POP(b) PUSH(src, a) PUSH(src, b))
+	OPC(OVR, 0x06, POP(a) POP(b) PUSH(src, b) PUSH(src, a) PUSH(src, b))
+	OPC(ROT, 0x07, POP(a) POP(b) POP(c) PUSH(src, b) PUSH(src, a) PUSH(src, c))
+	/* Logic */
+	OPC(EQU, 0x08, POP(a) POP(b) PUSH8(src, b == a))
+	OPC(NEQ, 0x09, POP(a) POP(b) PUSH8(src, b != a))
+	OPC(GTH, 0x0a, POP(a) POP(b) PUSH8(src, b > a))
+	OPC(LTH, 0x0b, POP(a) POP(b) PUSH8(src, b < a))
+	OPC(JMP, 0x0c, POP(a) WARP(a) PROFILE_RETURN(bs && _r && !_k))
+	OPC(JCN, 0x0d, POP(a) POP8(b) if(b) WARP(a))
+	OPC(JSR, 0x0e, POP(a) PUSH16(dst, pc) WARP(a) PROFILE_CALL(pc))
+	OPC(STH, 0x0f, POP(a) PUSH(dst, a))
+	/* Memory */
+	OPC(LDZ, 0x10, POP8(a) PEEK(b, a) PUSH(src, b))
+	OPC(STZ, 0x11, POP8(a) POP(b) POKE(a, b))
+	OPC(LDR, 0x12, POP8(a) PEEK(b, pc + (Sint8)a) PUSH(src, b))
+	OPC(STR, 0x13, POP8(a) POP(b) c = pc + (Sint8)a; POKE(c, b))
+	OPC(LDA, 0x14, POP16(a) PEEK(b, a) PUSH(src, b))
+	OPC(STA, 0x15, POP16(a) POP(b) POKE(a, b))
+	OPC(DEI, 0x16, POP8(a) DEVR(b, a) PUSH(src, b) RESUME)
+	OPC(DEO, 0x17, POP8(a) POP(b) DEVW(a, b) RESUME)
+	/* Arithmetic */
+	OPC(ADD, 0x18, POP(a) POP(b) PUSH(src, b + a))
+	OPC(SUB, 0x19, POP(a) POP(b) PUSH(src, b - a))
+	OPC(MUL, 0x1a, POP(a) POP(b) PUSH(src, (Uint32)b * a))
+	OPC(DIV, 0x1b, POP(a) POP(b) if(a == 0) HALT(4) PUSH(src, b / a))
+	OPC(AND, 0x1c, POP(a) POP(b) PUSH(src, b & a))
+	OPC(ORA, 0x1d, POP(a) POP(b) PUSH(src, b | a))
+	OPC(EOR, 0x1e, POP(a) POP(b) PUSH(src, b ^ a))
+	OPC(SFT, 0x1f, POP8(a) POP(b) c = b >> (a & 0x0f) << ((a & 0xf0) >> 4); PUSH(src, c))
+#ifdef UXN_PREDECODE
+	ENTRY(DECODE, -1) predecode(u->ram, --pc); DISPATCH
+	/* Fused */
+	FUSED(DEO_f, FUSE_DEO, w->ptr < 0xfe, a = pre.imm[pc - 1]; b = pre.aux[pc - 1]; pc += 4; u->deo(u, b, a); RESUME)
+	FUSED(DEO2_f, FUSE_DEO2, w->ptr < 0xfd, a = pre.imm[pc - 1]; b = pre.aux[pc - 1]; pc += 5; u->deo(u, b, a >> 8); u->deo(u, (b + 1) & 0xff, a); RESUME)
+	FUSED(JMP_f, FUSE_JMP, w->ptr < 0xff, pc = pre.imm[pc - 1];)
+	FUSED(JCN_f, FUSE_JCN, w->ptr && w->ptr < 0xff, pc = w->dat[--w->ptr] ? pre.imm[pc - 1] : pc + 2;)
+	FUSED(JSR_f, FUSE_JSR, w->ptr < 0xff && u->rst->ptr < 0xfe, a = pc + 2; k = u->rst->ptr; u->rst->dat[k] = a >> 8; u->rst->dat[k + 1] = a; u->rst->ptr = k + 2; pc = pre.imm[pc - 1];)
+	FUSED(JMP2_f, FUSE_JMP2, w->ptr < 0xfe, pc = pre.imm[pc - 1];)
+	FUSED(JCN2_f, FUSE_JCN2, w->ptr && w->ptr < 0xfe, pc = w->dat[--w->ptr] ? pre.imm[pc - 1] : pc + 3;)
+	FUSED(JSR2_f, FUSE_JSR2, w->ptr < 0xfe && u->rst->ptr < 0xfe, a = pc + 3; k = u->rst->ptr; u->rst->dat[k] = a >> 8; u->rst->dat[k + 1] = a; u->rst->ptr = k + 2; pc = pre.imm[pc - 1];)
+	FUSED(DUP2ADD2_f, FUSE_DUP2ADD2, w->ptr >= 2 && w->ptr < 0xfe, k = w->ptr; a = (w->dat[k - 2] << 8 | w->dat[k - 1]) << 1; w->dat[k - 2] = a >> 8; w->dat[k - 1] = a; pc += 1;)
+	FUSED(INC2DUP2LDA_f, FUSE_INC2DUP2LDA, w->ptr >= 2 && w->ptr < 0xfe, k = w->ptr; a = (w->dat[k - 2] << 8 | w->dat[k - 1]) + 1; w->dat[k - 2] = a >> 8; w->dat[k - 1] = a; w->dat[k] = u->ram[a & 0xffff]; w->ptr = k + 1; pc += 2;)
+	LITOPS(LITOP_FUSED)
+#endif
+#ifndef COMPUTED_GOTO
+	}
+#endif
+#if defined(UXN_PREDECODE) && !defined(COMPUTED_GOTO)
+	}
+#endif
+
+err:
+#ifdef UXN_PREDECODE
+	instr = u->ram[(Uint16)(pc - 1)];
+#endif
+	errcode |= ((errcode >> 1 & ((instr & 0x1e) == 0x0e)) ^ instr >> 6) & 1;
+	return uxn_halt(u, errcode, pc - 1);
+}
+
+#endif
+
 /* clang-format on */
 
 int
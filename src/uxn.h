@@ -44,4 +44,32 @@ int uxn_boot(Uxn *u, Uint8 *ram);
 int uxn_eval(Uxn *u, Uint16 pc);
 int uxn_halt(Uxn *u, Uint8 error, Uint16 addr);
 
+#if defined(UXN_JIT) || defined(UXN_AOT)
+int uxn_interpret(Uxn *u, Uint16 pc);
+#endif
+#if defined(UXN_JIT) || defined(UXN_AOT) || defined(UXN_PREDECODE)
+void uxn_invalidate(Uxn *u, Uint16 addr, Uint16 len);
+#else
+#define uxn_invalidate(u, addr, len) ((void)(u), (void)(addr), (void)(len))
+#endif
+
+#ifdef UXN_PROFILE
+typedef struct {
+	Uint16 addr, parent;
+	Uint32 calls, steps;
+} UxnFrame;
+
+typedef struct {
+	Uint32 ops[0x100], hits[0x10000];
+	Uint16 frame, length;
+	UxnFrame frames[0x4000];
+} UxnProfile;
+
+extern UxnProfile uxn_profile;
+void uxn_profile_enter(Uint16 addr);
+void uxn_profile_call(Uint16 addr);
+void uxn_profile_return(void);
+void uxn_profile_dump(Uxn *u);
+#endif
+
 #endif
\ No newline at end of file
@@ -3,10 +3,14 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/keysymdef.h>
-#include <sys/timerfd.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <unistd.h>
 #include <string.h>
 #include <poll.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "uxn.h"
 #include "devices/system.h"
@@ -22,16 +26,31 @@
 
 typedef struct Emulator {
 	Uxn u;
-	UxnScreen screen;
+	UxnScreen screen, view; /* view: the copy of the layers presented */
 	UxnFile *files[2];
 	XImage *ximage;
+	XShmSegmentInfo shm;
+	int shared;
 	Display *display;
 	Visual *visual;
 	Window window;
+	pthread_t render;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	int pending, drawing, quit;
+	double draw;       /* seconds the render thread takes per frame, on average */
+	int moved, mx, my; /* pointer motion not yet sent to the mouse */
+	FILE *console;     /* console output, stderr when frames go to stdout */
 } Emulator;
 
 #define WIDTH (64 * 8)
 #define HEIGHT (40 * 8)
+#define RATE 60        /* screen vector calls per second */
+#define FPS 60         /* presentations per second, at most */
+#define CATCHUP 4      /* vector calls per wakeup when behind */
+#define SKIPS 3        /* ticks without presentation when behind */
+#define EVENTS 64      /* X events handled per wakeup */
+#define OUTPUT 0x10000 /* bytes of console output held back */
 
 static int
 error(char *msg, const char *err)
@@ -55,15 +74,175 @@ console_input(Uxn *u, char c)
 	return uxn_eval(u, GETVECTOR(dat));
 }
 
+/* stdin is left to uxncli, a block read here finds nothing */
 static void
-console_deo(Uint8 *dat, Uint8 port)
+console_deo(Uxn *u, Uint8 *dat, Uint8 port)
 {
-	FILE *fd = port == 0x8 ? stdout : port == 0x9 ? stderr
-												  : 0;
-	if(fd) {
-		fputc(dat[port], fd);
-		fflush(fd);
+	Uint16 addr, len;
+	switch(port) {
+	case 0x8: fputc(dat[port], ((Emulator *)u)->console); break;
+	case 0x9: fputc(dat[port], stderr); break;
+	case 0xd: DEVPOKE16(dat, 0x4, 0); break;
+	case 0xf:
+		DEVPEEK16(addr, dat, 0xe);
+		DEVPEEK16(len, dat, 0xa);
+		if(len > 0x10000 - addr)
+			len = 0x10000 - addr;
+		len = fwrite(&u->ram[addr], 1, len, ((Emulator *)u)->console);
+		DEVPOKE16(dat, 0x4, len);
+		break;
+	}
+}
+
+/* Image: with MIT-SHM, the view pixels live in a segment shared with the
+X server and the damaged box is presented without going through the socket. */
+
+static int shm_failed;
+
+static int
+shm_error(Display *display, XErrorEvent *ev)
+{
+	(void)display;
+	(void)ev;
+	shm_failed = 1;
+	return 0;
+}
+
+static int
+shm_image(Emulator *m, int depth)
+{
+	UxnScreen *p = &m->view;
+	XErrorHandler handler;
+	if(!XShmQueryExtension(m->display))
+		return 0;
+	if(!(m->ximage = XShmCreateImage(m->display, m->visual, depth, ZPixmap, NULL, &m->shm, p->width, p->height)))
+		return 0;
+	if(m->ximage->bytes_per_line != p->width * 4 || (m->shm.shmid = shmget(IPC_PRIVATE, p->width * p->height * 4, IPC_CREAT | 0600)) < 0) {
+		XDestroyImage(m->ximage);
+		return 0;
+	}
+	m->shm.shmaddr = m->ximage->data = shmat(m->shm.shmid, NULL, 0);
+	m->shm.readOnly = False;
+	shm_failed = m->shm.shmaddr == (char *)-1;
+	/* attaching fails on remote displays, which only shows as an X error */
+	handler = XSetErrorHandler(shm_error);
+	if(!shm_failed)
+		XShmAttach(m->display, &m->shm);
+	XSync(m->display, False);
+	XSetErrorHandler(handler);
+	shmctl(m->shm.shmid, IPC_RMID, NULL);
+	if(shm_failed) {
+		if(m->shm.shmaddr != (char *)-1)
+			shmdt(m->shm.shmaddr);
+		m->ximage->data = NULL;
+		XDestroyImage(m->ximage);
+		return 0;
+	}
+	memcpy(m->shm.shmaddr, p->pixels, p->width * p->height * 4);
+	free(p->pixels);
+	p->pixels = (Uint32 *)m->shm.shmaddr;
+	m->shared = 1;
+	return 1;
+}
+
+static void
+create_image(Emulator *m)
+{
+	int depth = DefaultDepth(m->display, DefaultScreen(m->display));
+	if(!shm_image(m, depth))
+		m->ximage = XCreateImage(m->display, m->visual, depth, ZPixmap, 0, (char *)m->view.pixels, m->view.width, m->view.height, 32, 0);
+}
+
+static void
+destroy_image(Emulator *m)
+{
+	if(m->shared) {
+		XShmDetach(m->display, &m->shm);
+		XSync(m->display, False);
+		shmdt(m->shm.shmaddr);
+		m->view.pixels = NULL;
+		m->shared = 0;
+	}
+	/* the pixels belong to the view */
+	m->ximage->data = NULL;
+	XDestroyImage(m->ximage);
+	m->ximage = NULL;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Render thread: the emulation copies the damaged box of its layers to the
+view, and goes on with the next vector while the render thread composites the
+view and uploads it. The copy is only made while the render thread is idle,
+and waits for the next frame otherwise. */
+
+static void *
+render(void *arg)
+{
+	Emulator *m = arg;
+	UxnScreen *p = &m->view;
+	double t;
+	pthread_mutex_lock(&m->lock);
+	while(1) {
+		while(!m->pending && !m->quit)
+			pthread_cond_wait(&m->wake, &m->lock);
+		if(m->quit)
+			break;
+		m->pending = 0, m->drawing = 1;
+		pthread_mutex_unlock(&m->lock);
+		t = now();
+		screen_redraw(p);
+		/* the server is done reading the pixels once it has answered */
+		if(m->shared)
+			XShmPutImage(m->display, m->window, DefaultGC(m->display, 0), m->ximage, p->x1, p->y1, p->x1, p->y1, p->x2 - p->x1, p->y2 - p->y1, False);
+		else
+			XPutImage(m->display, m->window, DefaultGC(m->display, 0), m->ximage, p->x1, p->y1, p->x1, p->y1, p->x2 - p->x1, p->y2 - p->y1);
+		XSync(m->display, False);
+		pthread_mutex_lock(&m->lock);
+		m->draw += (now() - t - m->draw) / 8;
+		m->drawing = 0;
 	}
+	pthread_mutex_unlock(&m->lock);
+	return NULL;
+}
+
+static int
+present(Emulator *m)
+{
+	pthread_mutex_lock(&m->lock);
+	if(m->drawing) {
+		pthread_mutex_unlock(&m->lock);
+		return 0;
+	}
+	if(m->view.width != m->screen.width || m->view.height != m->screen.height) {
+		/* the image is rebuilt around the resized pixels */
+		destroy_image(m);
+		screen_resize(&m->view, m->screen.width, m->screen.height);
+		create_image(m);
+		XResizeWindow(m->display, m->window, m->view.width, m->view.height);
+		screen_change(&m->screen.fg, 0, 0, m->screen.width, m->screen.height);
+	}
+	screen_copy(&m->view, &m->screen);
+	m->pending = 1;
+	pthread_cond_signal(&m->wake);
+	pthread_mutex_unlock(&m->lock);
+	return 1;
+}
+
+static void
+stop(Emulator *m)
+{
+	pthread_mutex_lock(&m->lock);
+	m->quit = 1;
+	pthread_cond_signal(&m->wake);
+	pthread_mutex_unlock(&m->lock);
+	pthread_join(m->render, NULL);
 }
 
 static Uint8
@@ -90,20 +269,13 @@ uxn11_deo(Uxn *u, Uint8 addr, Uint8 v)
 	dat[p] = v;
 	switch(addr & 0xf0) {
 	case 0x00: system_deo(u, dat, p); break;
-	case 0x10: console_deo(dat, p); break;
+	case 0x10: console_deo(u, dat, p); break;
 	case 0x20: screen_deo(u, &m->screen, dat, p); break;
 	case 0xa0:
 	case 0xb0: file_deo(u, dat, m->files[dev_id - DEV_FILE0], p); break;
 	}
 }
 
-static void
-redraw(Emulator *m)
-{
-	screen_redraw(&m->screen);
-	XPutImage(m->display, m->window, DefaultGC(m->display, 0), m->ximage, 0, 0, 0, 0, m->screen.width, m->screen.height);
-}
-
 static void
 hide_cursor(Emulator *m)
 {
@@ -135,19 +307,38 @@ get_button(KeySym sym)
 	return 0x00;
 }
 
+/* Input: pointer motion is held back and only the latest position reaches
+the mouse vector, before the next other event or once the queue is drained,
+so buttons and keys keep their order relative to it. */
+
+static void
+send_motion(Emulator *m)
+{
+	if(m->moved) {
+		mouse_pos(&m->u, m->u.dev[DEV_MOUSE], m->mx, m->my);
+		m->moved = 0;
+	}
+}
+
 static void
 processEvent(Emulator *m)
 {
 	XEvent ev;
 	XNextEvent(m->display, &ev);
+	if(ev.type != MotionNotify)
+		send_motion(m);
 	switch(ev.type) {
 	case Expose:
-		redraw(m);
+		screen_change(&m->screen.fg, 0, 0, m->screen.width, m->screen.height);
 		break;
 	case ClientMessage: {
-		XDestroyImage(m->ximage);
+		stop(m);
+		destroy_image(m);
 		XDestroyWindow(m->display, m->window);
 		XCloseDisplay(m->display);
+#ifdef UXN_PROFILE
+		uxn_profile_dump(&m->u);
+#endif
 		exit(0);
 	} break;
 	case KeyPress: {
@@ -173,11 +364,85 @@ processEvent(Emulator *m)
 	} break;
 	case MotionNotify: {
 		XMotionEvent *e = (XMotionEvent *)&ev;
-		mouse_pos(&m->u, m->u.dev[DEV_MOUSE], e->x, e->y);
+		m->moved = 1, m->mx = e->x, m->my = e->y;
 	} break;
 	}
 }
 
+/* Headless */
+
+static void
+write_ppm(UxnScreen *p, FILE *f)
+{
+	Uint8 row[1024 * 3], *d;
+	Uint32 *pixels = p->pixels;
+	Uint16 x, y;
+	fprintf(f, "P6\n%d %d\n255\n", p->width, p->height);
+	for(y = 0; y < p->height; y++) {
+		for(x = 0, d = row; x < p->width; x++, pixels++)
+			*d++ = *pixels >> 16, *d++ = *pixels >> 8, *d++ = *pixels;
+		fwrite(row, 3, p->width, f);
+	}
+}
+
+static void
+write_y4m(UxnScreen *p, FILE *f)
+{
+	Uint8 row[1024];
+	Uint32 *pixels, c;
+	Uint16 x, y;
+	int plane, r, g, b;
+	fprintf(f, "FRAME\n");
+	for(plane = 0; plane < 3; plane++)
+		for(y = 0, pixels = p->pixels; y < p->height; y++) {
+			for(x = 0; x < p->width; x++, pixels++) {
+				c = *pixels, r = (c >> 16) & 0xff, g = (c >> 8) & 0xff, b = c & 0xff;
+				if(plane == 0)
+					row[x] = 16 + ((66 * r + 129 * g + 25 * b + 128) >> 8);
+				else if(plane == 1)
+					row[x] = 128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8);
+				else
+					row[x] = 128 + ((112 * r - 94 * g - 18 * b + 128) >> 8);
+			}
+			fwrite(row, 1, p->width, f);
+		}
+}
+
+static int
+headless(Emulator *m, Uint32 frames, char *path)
+{
+	Uint32 i;
+	Uint16 width = m->screen.width, height = m->screen.height;
+	int y4m = path && strlen(path) > 4 && !strcmp(path + strlen(path) - 4, ".y4m");
+	FILE *f = !path ? NULL : strcmp(path, "-") ? fopen(path, "wb") : stdout;
+	if(path && !f)
+		return error("Dump", path);
+	if(y4m)
+		fprintf(f, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C444\n", width, height);
+	for(i = 0; (!frames || i < frames) && !m->u.dev[0][0xf]; i++) {
+		uxn_eval(&m->u, GETVECTOR(m->u.dev[0x2]));
+		/* file requests complete within the frame, for frames that do not depend on timing */
+		while(file_complete(&m->u, m->u.dev[DEV_FILE0], m->files[0], 1) || file_complete(&m->u, m->u.dev[DEV_FILE0 + 1], m->files[1], 1))
+			;
+		file_flush(m->files[0]), file_flush(m->files[1]);
+		if(m->screen.fg.changed || m->screen.bg.changed)
+			screen_redraw(&m->screen);
+		if(!f) continue;
+		if(y4m && (m->screen.width != width || m->screen.height != height)) {
+			error("Dump", "Screen resized during y4m stream");
+			break;
+		}
+		if(y4m)
+			write_y4m(&m->screen, f);
+		else
+			write_ppm(&m->screen, f);
+	}
+	if(f && f != stdout)
+		fclose(f);
+	fprintf(stderr, "Ran %u frames\n", (unsigned)i);
+	return 1;
+}
+
 static int
 start(Emulator *m, char *rom)
 {
@@ -199,6 +464,7 @@ static int
 init(Emulator *m)
 {
 	Atom wmDelete;
+	XInitThreads();
 	m->display = XOpenDisplay(NULL);
 	m->visual = DefaultVisual(m->display, 0);
 	m->window = XCreateSimpleWindow(m->display, RootWindow(m->display, 0), 0, 0, m->screen.width, m->screen.height, 1, 0, 0);
@@ -208,26 +474,95 @@ init(Emulator *m)
 	wmDelete = XInternAtom(m->display, "WM_DELETE_WINDOW", True);
 	XSetWMProtocols(m->display, m->window, &wmDelete, 1);
 	XMapWindow(m->display, m->window);
-	m->ximage = XCreateImage(m->display, m->visual, DefaultDepth(m->display, DefaultScreen(m->display)), ZPixmap, 0, (char *)m->screen.pixels, m->screen.width, m->screen.height, 32, 0);
+	screen_resize(&m->view, m->screen.width, m->screen.height);
+	create_image(m);
 	hide_cursor(m);
+	pthread_mutex_init(&m->lock, NULL);
+	pthread_cond_init(&m->wake, NULL);
+	if(pthread_create(&m->render, NULL, render, m))
+		return error("Init", "Render thread failed");
 	return 1;
 }
 
+/* Scheduler: the screen vector is called on a fixed clock of rate ticks per
+second, catching up on missed ticks after a slow one, while presentation is
+paced separately at FPS. A frame is not presented when the time the composite
+usually takes would make the next tick late, so a slow screen costs frames
+rather than slowing the rom. With a rate of 0, the vector runs back to back. */
+
+static void
+run(Emulator *m, Uint32 rate)
+{
+	double t, wake, period = rate ? 1.0 / rate : 0, tick = now(), frame = tick, draw;
+	int i, n, skipped = 0;
+	struct pollfd fds[3];
+	fds[0].fd = XConnectionNumber(m->display);
+	fds[1].fd = file_fd(m->files[0]);
+	fds[2].fd = file_fd(m->files[1]);
+	fds[0].events = fds[1].events = fds[2].events = POLLIN;
+	while(1) {
+		t = now();
+		wake = rate ? tick : t;
+		if((m->screen.fg.changed || m->screen.bg.changed) && frame < wake)
+			wake = frame;
+		/* the render thread may have read events off the connection */
+		if(XEventsQueued(m->display, QueuedAlready))
+			wake = t;
+		fflush(stdout), fflush(stderr);
+		poll(fds, 3, wake > t ? (int)((wake - t) * 1000) + 1 : 0);
+		for(i = 0; i < 2; i++)
+			file_complete(&m->u, m->u.dev[DEV_FILE0 + i], m->files[i], 0);
+		for(n = 0; n < EVENTS && XPending(m->display); n++)
+			processEvent(m);
+		send_motion(m);
+		for(n = 0, t = now(); t >= tick && n < CATCHUP; n++, t = now()) {
+			uxn_eval(&m->u, GETVECTOR(m->u.dev[0x2]));
+			tick += period, skipped++;
+		}
+		for(i = 0; n && i < 2; i++)
+			file_flush(m->files[i]);
+		/* too far behind to catch up, the clock gives in */
+		if(t - tick > CATCHUP * period)
+			tick = t;
+		if((m->screen.fg.changed || m->screen.bg.changed) && t >= frame) {
+			frame = (t - frame < 1.0 / FPS ? frame : t) + 1.0 / FPS;
+			pthread_mutex_lock(&m->lock);
+			draw = m->draw;
+			pthread_mutex_unlock(&m->lock);
+			if((!rate || t + draw <= tick || skipped > SKIPS) && present(m))
+				skipped = 0;
+		}
+	}
+}
+
 int
 main(int argc, char **argv)
 {
 	Emulator m;
-	int i;
-	char expirations[8];
-	struct pollfd fds[2];
-	static const struct itimerspec screen_tspec = {{0, 16666666}, {0, 16666666}};
+	int i, nox = 0;
+	Uint32 frames = 0, rate = RATE;
+	char *dump = NULL;
 	memset(&m, 0, sizeof m); /* May not be necessary */
+	/* console output goes out by line on a terminal, and before each wait */
+	setvbuf(stdout, NULL, isatty(1) ? _IOLBF : _IOFBF, OUTPUT);
+	setvbuf(stderr, NULL, isatty(2) ? _IOLBF : _IOFBF, OUTPUT);
 	for(i = 0; i < 2; i++) m.files[i] = file_alloc();
-	if(argc < 2)
-		return error("Usage", "uxncli game.rom args");
+	for(; argc > 2 && argv[1][0] == '-'; argc -= 2, argv += 2) {
+		if(!strcmp(argv[1], "-f"))
+			frames = strtoul(argv[2], NULL, 10), nox = 1;
+		else if(!strcmp(argv[1], "-o"))
+			dump = argv[2], nox = 1;
+		else if(!strcmp(argv[1], "-r"))
+			rate = strtoul(argv[2], NULL, 10);
+		else
+			break;
+	}
+	m.console = dump && !strcmp(dump, "-") ? stderr : stdout;
+	if(argc < 2 || argv[1][0] == '-')
+		return error("Usage", "uxn11 [-r rate] [-f frames] [-o frames.ppm|frames.y4m] game.rom args");
 	if(!start(&m, argv[1]))
 		return error("Start", "Failed");
-	if(!init(&m))
+	if(!nox && !init(&m))
 		return error("Init", "Failed");
 	/* console vector */
 	for(i = 2; i < argc; i++) {
@@ -235,24 +570,18 @@ main(int argc, char **argv)
 		while(*p) console_input(&m.u, *p++);
 		console_input(&m.u, '\n');
 	}
-	fds[0].fd = XConnectionNumber(m.display);
-	fds[1].fd = timerfd_create(CLOCK_MONOTONIC, 0);
-	timerfd_settime(fds[1].fd, 0, &screen_tspec, NULL);
-	fds[0].events = fds[1].events = POLLIN;
-	/* main loop */
-	while(1) {
-		if(poll(fds, 2, 1000) <= 0)
-			continue;
-		while(XPending(m.display))
-			processEvent(&m);
-		if(poll(&fds[1], 1, 0)) {
-			read(fds[1].fd, expirations, 8);                /* Indicate we handled the timer */
-			uxn_eval(&m.u, GETVECTOR(m.u.dev[0x2])); /* Call the vector once, even if the timer fired multiple times */
-		}
-		if(m.screen.fg.changed || m.screen.bg.changed)
-			redraw(&m);
+	if(nox) {
+		headless(&m, frames, dump);
+#ifdef UXN_PROFILE
+		uxn_profile_dump(&m.u);
+#endif
+		for(i = 0; i < 2; i++) file_free(m.files[i]);
+		free(m.screen.pixels), free(m.screen.fg.pixels), free(m.screen.bg.pixels);
+		free(m.u.ram);
+		return 0;
 	}
-	XDestroyImage(m.ximage);
+	run(&m, rate);
+	destroy_image(&m);
 	for(i = 0; i < 2; i++) file_free(m.files[i]);
 	return 0;
 }
@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uxn.h"
+
+/*
+Copyright (c) 2022 Devine Lu Linvega, Andrew Alderwick, Andrew Richards
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+*/
+
+/* Ahead-of-time translator. The code reachable from PAGE_PROGRAM, from the
+return address of every JSR and from the vectors a ROM installs with
+LIT2 addr LIT port DEO2 is decoded, and each region of code connected by
+fall-through and literal jumps becomes one C function. The output provides
+uxn_eval, and is linked with src/uxn.c and a front end built with -DUXN_AOT.
+Anything the translation cannot follow, a computed jump outside the known
+entries, a stack error, relocated stacks or code that no longer matches the
+ROM, continues in uxn_interpret. */
+
+#define INSTR 0x01
+#define ENTRY 0x02
+#define LABEL 0x04
+#define FOLD 0x08
+#define OPERAND 0x10
+
+static Uint8 ram[0x10002], flags[0x10000];
+static Uint16 parent[0x10000], queue[0x10000], order[0x10000], home[0x10000], ids[0x10000];
+static Uint32 length, nqueue, first[0x10000], chain[0x10000];
+static FILE *out;
+
+static struct {
+	int ram, a, b, c, ws, rs, dispatch;
+} used;
+
+static const char *ops[] = {
+	"LIT", "INC", "POP", "DUP", "NIP", "SWP", "OVR", "ROT",
+	"EQU", "NEQ", "GTH", "LTH", "JMP", "JCN", "JSR", "STH",
+	"LDZ", "STZ", "LDR", "STR", "LDA", "STA", "DEI", "DEO",
+	"ADD", "SUB", "MUL", "DIV", "AND", "ORA", "EOR", "SFT"};
+
+static const char *prelude[] = {
+	"#include <string.h>",
+	"",
+	"#include \"uxn.h\"",
+	"",
+	"/* Generated by uxn2c, link with src/uxn.c built with -DUXN_AOT. */",
+	"",
+	"/* clang-format off */",
+	"",
+	"enum { EXIT_NEXT, EXIT_BRK, EXIT_HALT };",
+	"",
+	"#define PEEK2(d, i) ((d)[i] << 8 | (d)[(i) + 1])",
+	"#define POKE2(d, i, v) { (d)[i] = (v) >> 8; (d)[(i) + 1] = (v); }",
+	"#define MAPPED (u->wst != (Stack *)(u->ram + 0x10000) || u->rst != (Stack *)(u->ram + 0x10100))",
+	"#define SYNC { u->wst->ptr = wp; u->rst->ptr = rp; }",
+	"#define LEAVE(x, e) { SYNC *pcp = (x); return (e); }",
+	"#define RELOAD(x) { if(dirty || MAPPED) { *pcp = (x); return EXIT_NEXT; } wp = u->wst->ptr; rp = u->rst->ptr; }",
+	"#define CODE(x) (code[((x) & 0xffff) >> 3] >> ((x) & 7) & 1)",
+	"#define STORED(x, n) { if(CODE(x)) { dirty = 1; LEAVE(n, EXIT_NEXT) } }",
+	"",
+	NULL};
+
+static const char *epilogue[] = {
+	"static void",
+	"verify(Uint8 *ram)",
+	"{",
+	"\tUint32 i;",
+	"\tmemset(valid, 1, sizeof(valid));",
+	"\tfor(i = 0; i < sizeof(bytes) / sizeof(bytes[0]); i++)",
+	"\t\tif(ram[bytes[i].addr] != bytes[i].byte) valid[bytes[i].region] = 0;",
+	"\tdirty = 0;",
+	"}",
+	"",
+	"void",
+	"uxn_invalidate(Uxn *u, Uint16 addr, Uint16 len)",
+	"{",
+	"\tUint32 i;",
+	"\t(void)u;",
+	"\tfor(i = addr; i < (Uint32)addr + len && !dirty; i++)",
+	"\t\tdirty = CODE(i);",
+	"}",
+	"",
+	"int",
+	"uxn_eval(Uxn *u, Uint16 pc)",
+	"{",
+	"\tif(!pc || u->dev[0][0xf]) return 0;",
+	"\tfor(;;) {",
+	"\t\tif(dirty) verify(u->ram);",
+	"\t\tif(MAPPED) break;",
+	"\t\tswitch(enter(u, &pc)) {",
+	"\t\tcase EXIT_BRK: return 1;",
+	"\t\tcase EXIT_HALT: dirty = 1; return uxn_interpret(u, pc);",
+	"\t\t}",
+	"\t}",
+	"\t/* the interpreter's stores do not consult the code map */",
+	"\tdirty = 1;",
+	"\treturn uxn_interpret(u, pc);",
+	"}",
+	NULL};
+
+static int
+error(char *msg, const char *err)
+{
+	fprintf(stderr, "Error %s: %s\n", msg, err);
+	return 0;
+}
+
+static void
+lines(const char **text)
+{
+	while(*text)
+		fprintf(out, "%s\n", *text++);
+}
+
+/* Decoding */
+
+static int
+in_rom(Uint32 addr)
+{
+	return addr >= PAGE_PROGRAM && addr < PAGE_PROGRAM + length;
+}
+
+static Uint16
+find(Uint16 a)
+{
+	while(parent[a] != a)
+		a = parent[a] = parent[parent[a]];
+	return a;
+}
+
+static void
+join(Uint16 a, Uint16 b)
+{
+	if(in_rom(a) && in_rom(b))
+		parent[find(a)] = find(b);
+}
+
+static void
+enqueue(Uint16 addr, int entry)
+{
+	if(!in_rom(addr))
+		return;
+	if(entry)
+		flags[addr] |= ENTRY;
+	if(!(flags[addr] & INSTR))
+		queue[nqueue++] = addr;
+}
+
+static Uint16
+next_of(Uint16 addr)
+{
+	Uint8 instr = ram[addr];
+	return addr + 1 + (instr && !(instr & 0x1f) ? (instr & 0x20 ? 2 : 1) : 0);
+}
+
+static void
+decode(Uint16 pc)
+{
+	while(in_rom(pc) && !(flags[pc] & INSTR)) {
+		Uint8 instr = ram[pc], op = instr & 0x1f;
+		Uint16 next = next_of(pc);
+		flags[pc] |= INSTR;
+		if(!instr || op == 0x0c)
+			return;
+		if(op == 0x0e) {
+			enqueue(next, 1);
+			join(pc, next);
+			return;
+		}
+		join(pc, next);
+		pc = next;
+	}
+}
+
+/* Returns the address pushed by the literal before a jump, when there is one. */
+
+static int
+literal(Uint16 pc, Uint16 *target)
+{
+	Uint8 instr = ram[pc], w = instr & 0x20 ? 2 : 1;
+	Uint16 lit = pc - 1 - w;
+	if((instr & 0x1f) < 0x0c || (instr & 0x1f) > 0x0e || lit < PAGE_PROGRAM)
+		return 0;
+	if(!(flags[lit] & INSTR) || !ram[lit] || (ram[lit] | 0x80) != (0x80 | (instr & 0x60)))
+		return 0;
+	*target = w == 2 ? ram[pc - 2] << 8 | ram[pc - 1] : (Uint16)(pc + 1 + (Sint8)ram[pc - 1]);
+	return 1;
+}
+
+static void
+discover(void)
+{
+	Uint32 i;
+	enqueue(PAGE_PROGRAM, 1);
+	do {
+		while(nqueue)
+			decode(queue[--nqueue]);
+		for(i = PAGE_PROGRAM; i < PAGE_PROGRAM + length; i++) {
+			Uint16 target;
+			if(!(flags[i] & INSTR))
+				continue;
+			if(literal(i, &target)) {
+				join(i, target);
+				enqueue(target, 0);
+			}
+			/* LIT2 vector LIT port DEO2, with a port at the start of a device */
+			if(ram[i] == 0x37 && i >= PAGE_PROGRAM + 5 && ram[i - 2] == 0x80 && !(ram[i - 1] & 0x0f) && ram[i - 5] == 0xa0 && (flags[i - 5] & INSTR))
+				enqueue(ram[i - 4] << 8 | ram[i - 3], 1);
+		}
+	} while(nqueue);
+}
+
+/* Code generation */
+
+static const char *
+offset(int n)
+{
+	static char buf[4][16];
+	static int i;
+	char *s = buf[i++ & 3];
+	if(n > 0)
+		sprintf(s, " + %d", n);
+	else if(n < 0)
+		sprintf(s, " - %d", -n);
+	else
+		s[0] = 0;
+	return s;
+}
+
+static const char *
+stack(int s)
+{
+	if(s)
+		used.rs = 1;
+	else
+		used.ws = 1;
+	return s ? "rs" : "ws";
+}
+
+static const char *
+ptr(int s)
+{
+	return s ? "rp" : "wp";
+}
+
+static void
+pop(char var, int s, int depth, int w)
+{
+	if(var == 'a') used.a = 1;
+	if(var == 'b') used.b = 1;
+	if(var == 'c') used.c = 1;
+	if(w == 2)
+		fprintf(out, " %c = PEEK2(%s, %s%s);", var, stack(s), ptr(s), offset(-(depth + 2)));
+	else
+		fprintf(out, " %c = %s[%s%s];", var, stack(s), ptr(s), offset(-(depth + 1)));
+}
+
+static void
+push(const char *value, int s, int at, int w)
+{
+	if(w == 2)
+		fprintf(out, " POKE2(%s, %s%s, %s)", stack(s), ptr(s), offset(at), value);
+	else
+		fprintf(out, " %s[%s%s] = %s;", stack(s), ptr(s), offset(at), value);
+}
+
+static void
+move(int s, int n)
+{
+	if(n > 0)
+		fprintf(out, " %s += %d;", ptr(s), n);
+	else if(n < 0)
+		fprintf(out, " %s -= %d;", ptr(s), -n);
+}
+
+static void
+go(Uint16 target)
+{
+	if(flags[target] & INSTR)
+		fprintf(out, " goto L%04x;", target);
+	else
+		fprintf(out, " LEAVE(0x%04x, EXIT_NEXT)", target);
+}
+
+static void
+store(const char *addr, int w, Uint16 next)
+{
+	used.ram = used.b = 1;
+	if(w == 2)
+		fprintf(out, " POKE2(ram, %s, b) STORED(%s, 0x%04x) STORED(%s + 1, 0x%04x)", addr, addr, next, addr, next);
+	else
+		fprintf(out, " ram[%s] = b; STORED(%s, 0x%04x)", addr, addr, next);
+}
+
+static void
+instruction(Uint16 pc, int fold)
+{
+	Uint8 instr = ram[pc], op = instr & 0x1f;
+	int w = instr & 0x20 ? 2 : 1, s = !!(instr & 0x40), k = instr & 0x80;
+	int ina = w, inb = 0, inc = 0, outs = 0, outd = 0, nin, base;
+	Uint16 next = next_of(pc), target = 0;
+	fprintf(out, "\t/* %04x %s%s%s%s */", pc, instr ? ops[op] : "BRK", instr && w == 2 ? "2" : "", op && k ? "k" : "", instr && s ? "r" : "");
+	if(!instr) {
+		fprintf(out, " LEAVE(0x%04x, EXIT_BRK)\n", pc);
+		return;
+	}
+	switch(op) {
+	case 0x00: ina = 0, outs = w; break;
+	case 0x01: outs = w; break;
+	case 0x03: outs = w * 2; break;
+	case 0x04: inb = w, outs = w; break;
+	case 0x05: inb = w, outs = w * 2; break;
+	case 0x06: inb = w, outs = w * 3; break;
+	case 0x07: inb = w, inc = w, outs = w * 3; break;
+	case 0x08: case 0x09: case 0x0a: case 0x0b: inb = w, outs = 1; break;
+	case 0x0d: inb = 1; break;
+	case 0x0e: outd = 2; break;
+	case 0x0f: outd = w; break;
+	case 0x10: case 0x12: case 0x16: ina = 1, outs = w; break;
+	case 0x11: case 0x13: case 0x17: ina = 1, inb = w; break;
+	case 0x14: ina = 2, outs = w; break;
+	case 0x15: ina = 2, inb = w; break;
+	case 0x1f: ina = 1, inb = w, outs = w; break;
+	default:
+		if(op >= 0x18) inb = w, outs = w;
+	}
+	nin = ina + inb + inc;
+	base = k ? 0 : -nin;
+	if(nin || base + outs > 0 || outd) {
+		fprintf(out, " if(");
+		if(nin) fprintf(out, "%s < %d", ptr(s), nin);
+		if(base + outs > 0) fprintf(out, "%s%s > %d", nin ? " || " : "", ptr(s), 255 - (base + outs));
+		if(outd) fprintf(out, "%s%s > %d", nin || base + outs > 0 ? " || " : "", ptr(!s), 255 - outd);
+		fprintf(out, ") LEAVE(0x%04x, EXIT_HALT)", pc);
+	}
+	if(ina && op != 0x02) pop('a', s, 0, ina);
+	if(inb && op != 0x04) pop('b', s, ina, inb);
+	if(inc) pop('c', s, ina + inb, inc);
+	if(fold) literal(pc, &target);
+	switch(op) {
+	case 0x00:
+		used.ram = used.a = 1;
+		if(w == 2)
+			fprintf(out, " a = PEEK2(ram, 0x%04x);", (Uint16)(pc + 1));
+		else
+			fprintf(out, " a = ram[0x%04x];", (Uint16)(pc + 1));
+		push("a", s, base, w);
+		break;
+	case 0x01: push("a + 1", s, base, w); break;
+	case 0x02: break;
+	case 0x03: push("a", s, base, w), push("a", s, base + w, w); break;
+	case 0x04: push("a", s, base, w); break;
+	case 0x05: push("a", s, base, w), push("b", s, base + w, w); break;
+	case 0x06: push("b", s, base, w), push("a", s, base + w, w), push("b", s, base + w * 2, w); break;
+	case 0x07: push("b", s, base, w), push("a", s, base + w, w), push("c", s, base + w * 2, w); break;
+	case 0x08: push("b == a", s, base, 1); break;
+	case 0x09: push("b != a", s, base, 1); break;
+	case 0x0a: push("b > a", s, base, 1); break;
+	case 0x0b: push("b < a", s, base, 1); break;
+	case 0x0c: case 0x0d: case 0x0e:
+		if(op == 0x0e) {
+			char hb[8], lb[8];
+			sprintf(hb, "0x%02x", next >> 8);
+			sprintf(lb, "0x%02x", next & 0xff);
+			push(hb, !s, 0, 1), push(lb, !s, 1, 1);
+		}
+		move(s, base), move(!s, outd);
+		if(op == 0x0d) fprintf(out, " if(b) {");
+		if(fold)
+			go(target);
+		else {
+			if(w == 2)
+				fprintf(out, " pc = a;");
+			else
+				fprintf(out, " pc = 0x%04x + (Sint8)a;", next);
+			fprintf(out, " goto dispatch;");
+			used.dispatch = 1;
+		}
+		if(op == 0x0d) fprintf(out, " }");
+		fprintf(out, "\n");
+		return;
+	case 0x0f: push("a", !s, 0, w); break;
+	case 0x10: case 0x14:
+		fprintf(out, w == 2 ? " b = PEEK2(ram, a);" : " b = ram[a];");
+		push("b", s, base, w);
+		used.ram = used.b = 1;
+		break;
+	case 0x11: case 0x15:
+		move(s, base), base = 0;
+		store("a", w, next);
+		break;
+	case 0x12:
+		fprintf(out, " c = (Uint16)(0x%04x + (Sint8)a);", next);
+		fprintf(out, w == 2 ? " b = PEEK2(ram, c);" : " b = ram[c];");
+		push("b", s, base, w);
+		used.ram = used.b = used.c = 1;
+		break;
+	case 0x13:
+		fprintf(out, " c = (Uint16)(0x%04x + (Sint8)a);", next);
+		move(s, base), base = 0;
+		store("c", w, next);
+		used.c = 1;
+		break;
+	case 0x16:
+		move(s, base), base = 0;
+		fprintf(out, " SYNC b = u->dei(u, a);");
+		if(w == 2) fprintf(out, " b = (b << 8) + u->dei(u, (a + 1) & 0xff);");
+		push("b", s, 0, w);
+		used.b = 1;
+		break;
+	case 0x17:
+		move(s, base);
+		if(w == 2)
+			fprintf(out, " SYNC u->deo(u, a, b >> 8); u->deo(u, (a + 1) & 0xff, b);");
+		else
+			fprintf(out, " SYNC u->deo(u, a, b);");
+		fprintf(out, " RELOAD(0x%04x)\n", next);
+		return;
+	case 0x18: push("b + a", s, base, w); break;
+	case 0x19: push("b - a", s, base, w); break;
+	case 0x1a: push("b * a", s, base, w); break;
+	case 0x1b:
+		fprintf(out, " if(!a) LEAVE(0x%04x, EXIT_HALT)", pc);
+		push("b / a", s, base, w);
+		break;
+	case 0x1c: push("b & a", s, base, w); break;
+	case 0x1d: push("b | a", s, base, w); break;
+	case 0x1e: push("b ^ a", s, base, w); break;
+	case 0x1f: push("b >> (a & 0x0f) << ((a & 0xf0) >> 4)", s, base, w); break;
+	}
+	move(s, base + outs), move(!s, outd);
+	fprintf(out, "\n");
+}
+
+static int
+falls_through(Uint16 pc)
+{
+	Uint8 instr = ram[pc], op = instr & 0x1f;
+	return instr && op != 0x0c && op != 0x0e;
+}
+
+/* Orders the instructions of a region, and marks the jump targets that need labels. */
+
+static Uint32
+collect(Uint16 root)
+{
+	Uint32 i, n = 0;
+	for(i = first[root]; i; i = chain[i])
+		order[n++] = i;
+	for(i = 0; i < n; i++) {
+		Uint16 pc = order[i], next = next_of(pc), target;
+		if(i && order[i - 1] == pc - 1 - (ram[pc] & 0x20 ? 2 : 1) && literal(pc, &target)) {
+			flags[pc] |= FOLD;
+			flags[pc - 1] |= OPERAND, home[pc - 1] = root;
+			if(ram[pc] & 0x20) flags[pc - 2] |= OPERAND, home[pc - 2] = root;
+			if(flags[target] & INSTR) flags[target] |= LABEL;
+		}
+		if(falls_through(pc) && (flags[next] & INSTR) && (i + 1 == n || order[i + 1] != next))
+			flags[next] |= LABEL;
+	}
+	return n;
+}
+
+static void
+region(Uint16 root, FILE *body)
+{
+	Uint32 i, n = collect(root);
+	FILE *dst = out;
+	int ch;
+	memset(&used, 0, sizeof(used));
+	out = body;
+	for(i = 0; i < n; i++) {
+		Uint16 pc = order[i], next = next_of(pc);
+		int label = flags[pc] & (ENTRY | LABEL);
+		if((flags[pc] & FOLD) && label) {
+			fprintf(out, "\tif(0) {\nL%04x:\n", pc);
+			instruction(pc, 0);
+			fprintf(out, "\t} else {\n");
+			instruction(pc, 1);
+			fprintf(out, "\t}\n");
+		} else {
+			if(label) fprintf(out, "L%04x:\n", pc);
+			instruction(pc, flags[pc] & FOLD);
+		}
+		if(falls_through(pc) && (i + 1 == n || order[i + 1] != next)) {
+			fprintf(out, "\t");
+			go(next);
+			fprintf(out, "\n");
+		}
+	}
+	out = dst;
+	fprintf(out, "static int\nr%u(Uxn *u, Uint16 *pcp)\n{\n", ids[root]);
+	if(used.ram || used.ws || used.rs) {
+		fprintf(out, "\tUint8 ");
+		if(used.ram) fprintf(out, "*ram = u->ram%s", used.ws || used.rs ? ", " : "");
+		if(used.ws) fprintf(out, "*ws = u->wst->dat%s", used.rs ? ", " : "");
+		if(used.rs) fprintf(out, "*rs = u->rst->dat");
+		fprintf(out, ";\n");
+	}
+	fprintf(out, "\tunsigned int wp = u->wst->ptr, rp = u->rst->ptr");
+	if(used.a) fprintf(out, ", a");
+	if(used.b) fprintf(out, ", b");
+	if(used.c) fprintf(out, ", c");
+	fprintf(out, ";\n\tUint16 pc = *pcp;\n");
+	if(used.dispatch) fprintf(out, "dispatch:\n");
+	fprintf(out, "\tswitch(pc) {\n");
+	for(i = 0; i < n; i++)
+		if(flags[order[i]] & ENTRY)
+			fprintf(out, "\tcase 0x%04x: goto L%04x;\n", order[i], order[i]);
+	fprintf(out, "\t}\n\tLEAVE(pc, EXIT_NEXT)\n");
+	rewind(body);
+	while((ch = fgetc(body)) != EOF)
+		fputc(ch, out);
+	fprintf(out, "}\n\n");
+}
+
+static int
+translate(void)
+{
+	Uint32 i, j, n = 0;
+	static Uint32 last[0x10000];
+	FILE *body;
+	discover();
+	for(i = PAGE_PROGRAM; i < PAGE_PROGRAM + length; i++) {
+		Uint16 root;
+		if(!(flags[i] & INSTR))
+			continue;
+		root = find(i);
+		if(root == i)
+			ids[i] = n++;
+		if(first[root])
+			chain[last[root]] = i;
+		else
+			first[root] = i;
+		last[root] = i;
+	}
+	lines(prelude);
+	fprintf(out, "static Uint8 dirty = 1, valid[%u];\n", n);
+	/* the code map follows the regions, which mark the literals they fold */
+	fprintf(out, "static const Uint8 code[0x2000];\n\n");
+	for(i = PAGE_PROGRAM; i < PAGE_PROGRAM + length; i++) {
+		if(!(flags[i] & INSTR) || find(i) != i)
+			continue;
+		if(!(body = tmpfile()))
+			return error("Output", "Cannot create temporary file");
+		region(i, body);
+		fclose(body);
+	}
+	fprintf(out, "static const Uint8 code[0x2000] = {");
+	for(i = 0; i < 0x2000; i++) {
+		Uint8 bits = 0;
+		for(j = 0; j < 8; j++)
+			if(flags[i * 8 + j] & (INSTR | OPERAND)) bits |= 1 << j;
+		fprintf(out, "%s0x%02x,", i % 16 ? " " : "\n\t", bits);
+	}
+	fprintf(out, "};\n\nstatic const struct {\n\tUint16 addr, region;\n\tUint8 byte;\n} bytes[] = {");
+	for(i = PAGE_PROGRAM, j = 0; i < PAGE_PROGRAM + length; i++) {
+		if(flags[i] & INSTR)
+			fprintf(out, "%s{0x%04x, %u, 0x%02x},", j++ % 4 ? " " : "\n\t", i, ids[find(i)], ram[i]);
+		if((flags[i] & OPERAND) && (!(flags[i] & INSTR) || home[i] != find(i)))
+			fprintf(out, "%s{0x%04x, %u, 0x%02x},", j++ % 4 ? " " : "\n\t", i, ids[home[i]], ram[i]);
+	}
+	fprintf(out, "};\n\n");
+	fprintf(out, "static int\nenter(Uxn *u, Uint16 *pcp)\n{\n\tswitch(*pcp) {\n");
+	for(i = PAGE_PROGRAM; i < PAGE_PROGRAM + length; i++)
+		if((flags[i] & (INSTR | ENTRY)) == (INSTR | ENTRY))
+			fprintf(out, "\tcase 0x%04x: return valid[%u] ? r%u(u, pcp) : EXIT_HALT;\n", i, ids[find(i)], ids[find(i)]);
+	fprintf(out, "\t}\n\treturn EXIT_HALT;\n}\n\n");
+	lines(epilogue);
+	return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *f;
+	Uint32 i;
+	if(argc < 2)
+		return !error("Usage", "uxn2c input.rom [output.c]");
+	if(!(f = fopen(argv[1], "rb")))
+		return !error("Load", "Failed to open rom");
+	length = fread(ram + PAGE_PROGRAM, 1, 0x10000 - PAGE_PROGRAM, f);
+	fclose(f);
+	if(!length)
+		return !error("Load", "Empty rom");
+	if(argc > 2 && !(out = fopen(argv[2], "w")))
+		return !error("Output", "Failed to open output");
+	if(argc < 3)
+		out = stdout;
+	for(i = 0; i < 0x10000; i++)
+		parent[i] = i;
+	if(!translate())
+		return 1;
+	if(out != stdout)
+		fclose(out);
+	return 0;
+}
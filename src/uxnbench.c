@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "uxn.h"
+#include "devices/system.h"
+#include "devices/screen.h"
+#include "devices/file.h"
+
+/*
+Copyright (c) 2022 Devine Lu Linvega, Andrew Alderwick, Andrew Richards
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+*/
+
+/* Headless benchmarks: each case boots one of the roms below, runs its reset
+vector, then calls its screen vector and redraws for a number of frames.
+Every run executes the same instructions, the counts given with each case
+turn times into MIPS. Lines are printed in the same order and format on
+every build so results can be diffed. */
+
+#define DEV_FILE0 0xa
+#define WIDTH (64 * 8)
+#define HEIGHT (40 * 8)
+#define SCRATCH "uxnbench.tmp"
+#define SCRATCH_SIZE 0x100000
+
+typedef struct Emulator {
+	Uxn u;
+	UxnScreen screen;
+	UxnFile *files[2];
+} Emulator;
+
+/*
+|0100
+	#0040
+	@outer
+		#0000
+		@inner
+			INC2 DUP2 #0003 ADD2 #0002 MUL2 POP2
+			DUP2 #ffff NEQ2 ;inner JCN2
+		POP2
+		#0001 SUB2 DUP2 #0000 NEQ2 ;outer JCN2
+	POP2
+BRK
+*/
+
+static Uint8 arith_rom[] = {
+	0xa0, 0x00, 0x40, 0xa0, 0x00, 0x00, 0x21, 0x23, 0xa0, 0x00, 0x03, 0x38,
+	0xa0, 0x00, 0x02, 0x3a, 0x22, 0x23, 0xa0, 0xff, 0xff, 0x29, 0xa0, 0x01,
+	0x06, 0x2d, 0x22, 0xa0, 0x00, 0x01, 0x39, 0x23, 0xa0, 0x00, 0x00, 0x29,
+	0xa0, 0x01, 0x03, 0x2d, 0x22, 0x00};
+
+/*
+|0100
+	#001e ;fib JSR2 POP2
+BRK
+@fib ( n* -- fib* )
+	DUP2 #0002 LTH2 ;fib-end JCN2
+	DUP2 #0001 SUB2 ;fib JSR2
+	SWP2 #0002 SUB2 ;fib JSR2
+	ADD2
+	@fib-end
+	JMP2r
+*/
+
+static Uint8 fib_rom[] = {
+	0xa0, 0x00, 0x1e, 0xa0, 0x01, 0x09, 0x2e, 0x22, 0x00, 0x23, 0xa0, 0x00,
+	0x02, 0x2b, 0xa0, 0x01, 0x25, 0x2d, 0x23, 0xa0, 0x00, 0x01, 0x39, 0xa0,
+	0x01, 0x09, 0x2e, 0x25, 0xa0, 0x00, 0x02, 0x39, 0xa0, 0x01, 0x09, 0x2e,
+	0x38, 0x6c};
+
+/*
+|0100
+	#0100
+	@pass
+		#0000
+		@copy
+			DUP2 #4000 ADD2 LDA
+			OVR2 #8000 ADD2 STA
+			INC2 DUP2 #2000 NEQ2 ;copy JCN2
+		POP2
+		#0001 SUB2 DUP2 #0000 NEQ2 ;pass JCN2
+	POP2
+BRK
+*/
+
+static Uint8 copy_rom[] = {
+	0xa0, 0x01, 0x00, 0xa0, 0x00, 0x00, 0x23, 0xa0, 0x40, 0x00, 0x38, 0x14,
+	0x26, 0xa0, 0x80, 0x00, 0x38, 0x15, 0x21, 0x23, 0xa0, 0x20, 0x00, 0x29,
+	0xa0, 0x01, 0x06, 0x2d, 0x22, 0xa0, 0x00, 0x01, 0x39, 0x23, 0xa0, 0x00,
+	0x00, 0x29, 0xa0, 0x01, 0x03, 0x2d, 0x22, 0x00};
+
+/*
+|20 @Screen-vector |26 @Screen-auto |28 @Screen-x |2a @Screen-y |2c @Screen-addr |2f @Screen-sprite
+|0100
+	;on-frame .Screen-vector DEO2
+	#01 .Screen-auto DEO
+	;tile .Screen-addr DEO2
+BRK
+@on-frame
+	#0000 .Screen-y DEO2
+	#28
+	@row
+		#0000 .Screen-x DEO2
+		#40
+		@col
+			#81 .Screen-sprite DEO
+			#01 SUB DUP ,col JCN
+		POP
+		.Screen-y DEI2 #0008 ADD2 .Screen-y DEO2
+		#01 SUB DUP ,row JCN
+	POP
+BRK
+@tile 3c 42 99 a5 a5 99 42 3c 00 3c 7e 7e 7e 7e 3c 00
+*/
+
+static Uint8 sprite_rom[] = {
+	0xa0, 0x01, 0x12, 0x80, 0x20, 0x37, 0x80, 0x01, 0x80, 0x26, 0x17, 0xa0,
+	0x01, 0x42, 0x80, 0x2c, 0x37, 0x00, 0xa0, 0x00, 0x00, 0x80, 0x2a, 0x37,
+	0x80, 0x28, 0xa0, 0x00, 0x00, 0x80, 0x28, 0x37, 0x80, 0x40, 0x80, 0x81,
+	0x80, 0x2f, 0x17, 0x80, 0x01, 0x19, 0x03, 0x80, 0xf4, 0x0d, 0x02, 0x80,
+	0x2a, 0x36, 0xa0, 0x00, 0x08, 0x38, 0x80, 0x2a, 0x37, 0x80, 0x01, 0x19,
+	0x03, 0x80, 0xda, 0x0d, 0x02, 0x00, 0x3c, 0x42, 0x99, 0xa5, 0xa5, 0x99,
+	0x42, 0x3c, 0x00, 0x3c, 0x7e, 0x7e, 0x7e, 0x7e, 0x3c, 0x00};
+
+/*
+|a2 @File-success |a8 @File-name |aa @File-length |ac @File-read
+|0100
+	#8000 .File-length DEO2
+	#0400
+	@pass
+		;name .File-name DEO2
+		@read
+			#4000 .File-read DEO2
+			.File-success DEI2 ORA ,read JCN
+		#0001 SUB2 DUP2 #0000 NEQ2 ;pass JCN2
+	POP2
+BRK
+@name "uxnbench.tmp 00
+*/
+
+static Uint8 file_rom[] = {
+	0xa0, 0x80, 0x00, 0x80, 0xaa, 0x37, 0xa0, 0x04, 0x00, 0xa0, 0x01, 0x2b,
+	0x80, 0xa8, 0x37, 0xa0, 0x40, 0x00, 0x80, 0xac, 0x37, 0x80, 0xa2, 0x36,
+	0x1d, 0x80, 0xf3, 0x0d, 0xa0, 0x00, 0x01, 0x39, 0x23, 0xa0, 0x00, 0x00,
+	0x29, 0xa0, 0x01, 0x09, 0x2d, 0x22, 0x00, 0x75, 0x78, 0x6e, 0x62, 0x65,
+	0x6e, 0x63, 0x68, 0x2e, 0x74, 0x6d, 0x70, 0x00};
+
+typedef struct Bench {
+	char *name;
+	Uint8 *rom;
+	Uint16 length, frames;
+	double ops;
+	Uint32 bytes;
+} Bench;
+
+static Bench benches[] = {
+	{"arith", arith_rom, sizeof(arith_rom), 0, 50331458, 0},
+	{"fib", fib_rom, sizeof(fib_rom), 0, 30964174, 0},
+	{"copy", copy_rom, sizeof(copy_rom), 0, 14588039, 0},
+	{"sprite", sprite_rom, sizeof(sprite_rom), 300, 6337509, 0},
+	{"file", file_rom, sizeof(file_rom), 0, 280581, 0x400 * SCRATCH_SIZE}};
+
+static int
+error(char *msg, const char *err)
+{
+	fprintf(stderr, "Error %s: %s\n", msg, err);
+	return 0;
+}
+
+void
+system_deo_special(Uxn *u, Uint8 *dat, Uint8 port)
+{
+	if(port > 0x7 && port < 0xe)
+		screen_palette(&((Emulator *)u)->screen, &dat[0x8]);
+}
+
+static Uint8
+uxnbench_dei(Uxn *u, Uint8 addr)
+{
+	Emulator *m = (Emulator *)u;
+	int dev_id = addr >> 4;
+	Uint8 p = addr & 0x0f, *dat = u->dev[dev_id];
+	switch(addr & 0xf0) {
+	case 0x20: screen_dei(&m->screen, dat, p); break;
+	case 0xa0:
+	case 0xb0: file_dei(u, dat, m->files[dev_id - DEV_FILE0], p); break;
+	}
+	return dat[p];
+}
+
+static void
+uxnbench_deo(Uxn *u, Uint8 addr, Uint8 v)
+{
+	Emulator *m = (Emulator *)u;
+	int dev_id = addr >> 4;
+	Uint8 p = addr & 0x0f, *dat = u->dev[dev_id];
+	dat[p] = v;
+	switch(addr & 0xf0) {
+	case 0x00: system_deo(u, dat, p); break;
+	case 0x20: screen_deo(u, &m->screen, dat, p); break;
+	case 0xa0:
+	case 0xb0: file_deo(u, dat, m->files[dev_id - DEV_FILE0], p); break;
+	}
+}
+
+static double
+now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static double
+run(Emulator *m, Uint8 *ram, Bench *b)
+{
+	Uint16 i;
+	double start;
+	memset(ram, 0, 0x10200);
+	uxn_boot(&m->u, ram);
+	/* a Uint16 length stops short of the last byte */
+	uxn_invalidate(&m->u, 0x0000, 0xffff);
+	uxn_invalidate(&m->u, 0xffff, 1);
+	m->u.dei = uxnbench_dei;
+	m->u.deo = uxnbench_deo;
+	memcpy(&ram[PAGE_PROGRAM], b->rom, b->length);
+	start = now();
+	if(!uxn_eval(&m->u, PAGE_PROGRAM))
+		return -1;
+	for(i = 0; i < b->frames; i++) {
+		uxn_eval(&m->u, GETVECTOR(m->u.dev[0x2]));
+		screen_redraw(&m->screen);
+	}
+	return now() - start;
+}
+
+static int
+scratch(void)
+{
+	FILE *f = fopen(SCRATCH, "wb");
+	Uint32 i;
+	if(!f) return 0;
+	for(i = 0; i < SCRATCH_SIZE; i++)
+		fputc(i * 7, f);
+	fclose(f);
+	return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	Emulator m;
+	Uint8 *ram;
+	Bench *b;
+	double t, best;
+	int i, j, repeat = 5, picked = 0;
+	if(argc > 2 && !strcmp(argv[1], "-n"))
+		repeat = atoi(argv[2]), argv += 2, argc -= 2;
+	if(repeat < 1 || !(ram = (Uint8 *)calloc(0x10200, sizeof(Uint8))))
+		return error("Usage", "uxnbench [-n repeat] [case..]");
+	if(!scratch())
+		return error("Scratch", SCRATCH);
+	memset(&m, 0, sizeof m);
+	for(i = 0; i < 2; i++) m.files[i] = file_alloc();
+	screen_resize(&m.screen, WIDTH, HEIGHT);
+	for(b = benches; b < benches + sizeof(benches) / sizeof(*b); b++) {
+		for(j = 1, picked = argc < 2; j < argc; j++)
+			if(!strcmp(argv[j], b->name)) picked = 1;
+		if(!picked) continue;
+		for(j = 0, best = -1; j < repeat; j++)
+			if((t = run(&m, ram, b)) >= 0 && (best < 0 || t < best))
+				best = t;
+		if(best < 0) {
+			printf("%-8s failed\n", b->name);
+			continue;
+		}
+		printf("%-8s %10.2f ms %12.0f ops %10.2f MIPS %8.3f ns/op", b->name, best * 1e3, b->ops, b->ops / best * 1e-6, best * 1e9 / b->ops);
+		if(b->frames)
+			printf(" %10.2f fps", b->frames / best);
+		if(b->bytes)
+			printf(" %10.2f MiB/s", b->bytes / best / 0x100000);
+		printf("\n");
+	}
+	remove(SCRATCH);
+#ifdef UXN_PROFILE
+	uxn_profile_dump(&m.u);
+#endif
+	for(i = 0; i < 2; i++) file_free(m.files[i]);
+	free(m.screen.pixels), free(m.screen.fg.pixels), free(m.screen.bg.pixels);
+	free(ram);
+	return 0;
+}
@@ -1,5 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "uxn.h"
 #include "devices/system.h"
@@ -24,106 +27,175 @@ error(char *msg, const char *err)
 	return 0;
 }
 
+#define INPUT 0x10000
+#define OUTPUT 0x10000
+
+typedef struct Emulator {
+	Uxn u;
+	UxnFile *files[2];
+	Uint8 input[INPUT];
+	ssize_t head, tail;
+	int eof;
+} Emulator;
+
+#define DEV_FILE0 0xa
+
 void
-system_deo_special(Uxn *u, Device *d, Uint8 port)
+system_deo_special(Uxn *u, Uint8 *dat, Uint8 port)
 {
 	(void)u;
-	(void)d;
+	(void)dat;
 	(void)port;
 }
 
+/* Console: stdin is read a block at a time and handed to the console vector
+from there, or straight to RAM through the read port. Output stays in the
+buffers of stdout and stderr, flushed by line when they go to a terminal, and
+otherwise once the ROM waits on input. */
+
+static int
+console_fill(Emulator *m)
+{
+	ssize_t n;
+	file_flush(m->files[0]), file_flush(m->files[1]);
+	fflush(stdout), fflush(stderr);
+	if(m->eof)
+		return 0;
+	do
+		n = read(0, m->input, INPUT);
+	while(n < 0 && errno == EINTR);
+	if(n <= 0) {
+		m->eof = 1;
+		return 0;
+	}
+	m->head = 0, m->tail = n;
+	return 1;
+}
+
+static Uint16
+console_read(Emulator *m, Uint8 *dest, Uint16 len)
+{
+	Uint16 n;
+	if(!len || (m->head == m->tail && !console_fill(m)))
+		return 0;
+	n = m->tail - m->head < len ? m->tail - m->head : len;
+	memcpy(dest, m->input + m->head, n);
+	m->head += n;
+	return n;
+}
+
 static void
-console_deo(Device *d, Uint8 port)
+console_deo(Emulator *m, Uint8 *dat, Uint8 port)
 {
-	FILE *fd = port == 0x8 ? stdout : port == 0x9 ? stderr
-												  : 0;
-	if(fd) {
-		fputc(d->dat[port], fd);
-		fflush(fd);
+	Uint16 addr, len;
+	switch(port) {
+	case 0x8: fputc(dat[port], stdout); break;
+	case 0x9: fputc(dat[port], stderr); break;
+	case 0xd:
+	case 0xf:
+		DEVPEEK16(addr, dat, port - 1);
+		DEVPEEK16(len, dat, 0xa);
+		if(len > 0x10000 - addr)
+			len = 0x10000 - addr;
+		if(port == 0xd) {
+			len = console_read(m, &m->u.ram[addr], len);
+			uxn_invalidate(&m->u, addr, len);
+		} else
+			len = fwrite(&m->u.ram[addr], 1, len, stdout);
+		DEVPOKE16(dat, 0x4, len);
+		break;
 	}
 }
 
 static Uint8
-nil_dei(Device *d, Uint8 port)
+uxncli_dei(Uxn *u, Uint8 addr)
 {
-	return d->dat[port];
+	Emulator *m = (Emulator *)u;
+	int dev_id = addr >> 4;
+	Uint8 p = addr & 0x0f, *dat = u->dev[dev_id];
+	switch(addr & 0xf0) {
+	case 0xa0:
+	case 0xb0: file_dei(u, dat, m->files[dev_id - DEV_FILE0], p); break;
+	case 0xc0: datetime_dei(dat, p); break;
+	}
+	return dat[p];
 }
 
 static void
-nil_deo(Device *d, Uint8 port)
+uxncli_deo(Uxn *u, Uint8 addr, Uint8 v)
 {
-	(void)d;
-	(void)port;
+	Emulator *m = (Emulator *)u;
+	int dev_id = addr >> 4;
+	Uint8 p = addr & 0x0f, *dat = u->dev[dev_id];
+	dat[p] = v;
+	switch(addr & 0xf0) {
+	case 0x00: system_deo(u, dat, p); break;
+	case 0x10: console_deo(m, dat, p); break;
+	case 0xa0:
+	case 0xb0: file_deo(u, dat, m->files[dev_id - DEV_FILE0], p); break;
+	}
 }
 
 static int
 console_input(Uxn *u, char c)
 {
-	Device *d = &u->dev[1];
-	d->dat[0x2] = c;
-	return uxn_eval(u, GETVECTOR(d));
+	Uint8 *dat = u->dev[1];
+	dat[0x2] = c;
+	return uxn_eval(u, GETVECTOR(dat));
 }
 
 static void
-run(Uxn *u)
+run(Emulator *m)
 {
-	Device *d = &u->dev[0];
-	while(!d->dat[0xf]) {
-		int c = fgetc(stdin);
-		if(c != EOF)
-			console_input(u, (Uint8)c);
+	Uxn *u = &m->u;
+	while(!u->dev[0][0xf]) {
+		/* file requests in flight come before the next input */
+		if(file_complete(u, u->dev[DEV_FILE0], m->files[0], 1) || file_complete(u, u->dev[DEV_FILE0 + 1], m->files[1], 1))
+			continue;
+		/* past the end of input, with no request left, nothing more can run */
+		if(m->head == m->tail && !console_fill(m))
+			break;
+		console_input(u, m->input[m->head++]);
 	}
 }
 
-int
-uxn_interrupt(void)
-{
-	return 1;
-}
-
 static int
-start(Uxn *u)
+start(Emulator *m)
 {
-	if(!uxn_boot(u, (Uint8 *)calloc(0x10200, sizeof(Uint8))))
+	if(!uxn_boot(&m->u, (Uint8 *)calloc(0x10200, sizeof(Uint8))))
 		return error("Boot", "Failed");
-	/* system   */ uxn_port(u, 0x0, nil_dei, system_deo);
-	/* console  */ uxn_port(u, 0x1, nil_dei, console_deo);
-	/* empty    */ uxn_port(u, 0x2, nil_dei, nil_deo);
-	/* empty    */ uxn_port(u, 0x3, nil_dei, nil_deo);
-	/* empty    */ uxn_port(u, 0x4, nil_dei, nil_deo);
-	/* empty    */ uxn_port(u, 0x5, nil_dei, nil_deo);
-	/* empty    */ uxn_port(u, 0x6, nil_dei, nil_deo);
-	/* empty    */ uxn_port(u, 0x7, nil_dei, nil_deo);
-	/* empty    */ uxn_port(u, 0x8, nil_dei, nil_deo);
-	/* empty    */ uxn_port(u, 0x9, nil_dei, nil_deo);
-	/* file0    */ uxn_port(u, 0xa, file_dei, file_deo);
-	/* file1    */ uxn_port(u, 0xb, file_dei, file_deo);
-	/* datetime */ uxn_port(u, 0xc, datetime_dei, nil_deo);
-	/* empty    */ uxn_port(u, 0xd, nil_dei, nil_deo);
-	/* empty    */ uxn_port(u, 0xe, nil_dei, nil_deo);
-	/* empty    */ uxn_port(u, 0xf, nil_dei, nil_deo);
+	m->u.dei = uxncli_dei;
+	m->u.deo = uxncli_deo;
 	return 1;
 }
 
 int
 main(int argc, char **argv)
 {
-	Uxn u;
+	Emulator m;
 	int i;
+	memset(&m, 0, sizeof m);
+	setvbuf(stdout, NULL, isatty(1) ? _IOLBF : _IOFBF, OUTPUT);
+	setvbuf(stderr, NULL, isatty(2) ? _IOLBF : _IOFBF, OUTPUT);
+	for(i = 0; i < 2; i++) m.files[i] = file_alloc();
 	if(argc < 2)
 		return error("Usage", "uxncli game.rom args");
-	if(!start(&u))
+	if(!start(&m))
 		return error("Start", "Failed");
-	if(!load_rom(&u, argv[1]))
+	if(!load_rom(&m.u, argv[1]))
 		return error("Load", "Failed");
 	fprintf(stderr, "Loaded %s\n", argv[1]);
-	if(!uxn_eval(&u, PAGE_PROGRAM))
+	if(!uxn_eval(&m.u, PAGE_PROGRAM))
 		return error("Init", "Failed");
 	for(i = 2; i < argc; i++) {
 		char *p = argv[i];
-		while(*p) console_input(&u, *p++);
-		console_input(&u, '\n');
+		while(*p) console_input(&m.u, *p++);
+		console_input(&m.u, '\n');
 	}
-	run(&u);
+	run(&m);
+#ifdef UXN_PROFILE
+	uxn_profile_dump(&m.u);
+#endif
+	for(i = 0; i < 2; i++) file_free(m.files[i]);
 	return 0;
 }